@@ -2,13 +2,69 @@
 #include <iomanip>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <charconv>
+#include <limits>
+#include <stdexcept>
+#include <iterator>
 #include <cassert>
 #include <chrono>
 #include <cstdint>
 #include <stack>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <system_error>
 #include <map>
-#include <format>
+#include <unordered_set>
+#include <algorithm>
+#include <variant>
+#include <cstring>
+#include <cmath>
+#include <bit>
+#include <functional>
+#include <initializer_list>
+#include <span>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <array>
+#include <memory_resource>
+#include <memory>
+#include <cstdio>
+#include <cstddef>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#define JSON_HAS_MMAP 1
+#else
+#include <fstream>
+#endif
+
+#if defined(JSON_BENCHMARK)
+#include <cstdlib>
+#if defined(JSON_HAS_MMAP)
+#include <sys/resource.h>
+#endif
+#endif
+
+#if defined(JSON_STATS) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 enum class JSON_Type
 {
@@ -20,17 +76,410 @@ enum class JSON_Type
     NIL     = 5, // Unfortunately NULL is already defined in C++
 };
 
+struct JSON_Error : std::runtime_error
+{
+    size_t offset; // byte offset into the input where parsing stopped
+
+    JSON_Error(const char *what, size_t offset) : std::runtime_error(what), offset(offset) {}
+};
+
+struct JSON_Patch_Error : std::runtime_error
+{
+    size_t operation; // index of the patch operation that failed
+
+    JSON_Patch_Error(const char *what, size_t operation) : std::runtime_error(what), operation(operation) {}
+};
+
+// Stores each distinct object key once. Trees parsed with
+// JSON_Parse_Options::keys borrow their keys from the table, so keys repeated
+// across objects and documents share one copy, and a lookup with a key taken
+// from the table matches on its pointer. The table must outlive those trees.
+// It is not synchronized.
+struct JSON_Key_Table
+{
+    explicit JSON_Key_Table(std::pmr::memory_resource *upstream = std::pmr::get_default_resource())
+        : storage(upstream) {}
+
+    std::string_view intern(std::string_view key)
+    {
+        auto found = keys.find(key);
+        if (found != keys.end())
+        {
+            return *found;
+        }
+        char *copy = static_cast<char*>(storage.allocate(std::max<size_t>(key.size(), 1), 1));
+        std::memcpy(copy, key.data(), key.size());
+        return *keys.insert(std::string_view(copy, key.size())).first;
+    }
+
+    size_t size() const
+    {
+        return keys.size();
+    }
+
+private:
+    std::pmr::monotonic_buffer_resource storage;
+    std::unordered_set<std::string_view> keys;
+};
+
+#if defined(JSON_STATS)
+// What parses given this struct through JSON_Parse_Options::stats did, for
+// builds with JSON_STATS defined; without it no counting code is compiled.
+// Counters add up across parses until reset with stats = {}.
+struct JSON_Value;
+struct JSON_Parse_Stats
+{
+    size_t bytes = 0;         // input fed to the reader
+    size_t values[6] = {};    // by JSON_Type
+    size_t keys = 0;
+    size_t max_depth = 0;
+    size_t allocations = 0;   // through a JSON_Stats_Resource
+    size_t allocated_bytes = 0;
+
+    // In json_stats_ticks() units. The tokenizer's own share is what total
+    // leaves after the other three.
+    uint64_t total_ticks = 0;   // inside the reader, handler included
+    uint64_t number_ticks = 0;  // converting number literals
+    uint64_t string_ticks = 0;  // validating UTF-8 and decoding escapes
+    uint64_t handler_ticks = 0; // inside the handler, e.g. building the tree
+
+    // The counters as one JSON object, e.g. for a log line
+    JSON_Value to_value() const;
+};
+
+// Time stamp counter cycles on x86, steady clock nanoseconds elsewhere
+static uint64_t json_stats_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Adds the ticks of its scope to a counter, if there is one
+struct JSON_Stats_Timer
+{
+    explicit JSON_Stats_Timer(uint64_t *ticks) : ticks(ticks), start(ticks ? json_stats_ticks() : 0) {}
+    ~JSON_Stats_Timer()
+    {
+        if (ticks)
+        {
+            *ticks += json_stats_ticks() - start;
+        }
+    }
+
+    uint64_t *ticks;
+    uint64_t start;
+};
+
+// Pass-through resource that counts what a tree takes from upstream. Parse
+// into it to fill the allocation counters; like any resource, it must
+// outlive the trees that use it.
+struct JSON_Stats_Resource : std::pmr::memory_resource
+{
+    explicit JSON_Stats_Resource(JSON_Parse_Stats& stats,
+                                 std::pmr::memory_resource *upstream = std::pmr::get_default_resource())
+        : stats(stats), upstream(upstream) {}
+
+    void *do_allocate(size_t bytes, size_t alignment) override
+    {
+        stats.allocations++;
+        stats.allocated_bytes += bytes;
+        return upstream->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override
+    {
+        upstream->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    JSON_Parse_Stats& stats;
+    std::pmr::memory_resource *upstream;
+};
+#endif
+
+struct JSON_Parse_Options
+{
+    // Keep string values and object keys as views into the input instead of
+    // copying them. The input must then outlive the parsed tree. Strings that
+    // contain escape sequences are still decoded into owned storage.
+    bool borrow_strings = false;
+
+    // Intern object keys in this table instead of storing them per object.
+    // Takes precedence over borrow_strings for keys.
+    JSON_Key_Table *keys = nullptr;
+
+    // Nesting deeper than this is refused, which bounds the parser's own
+    // stacks and the depth of every tree it builds
+    size_t max_depth = 1024;
+
+    // Documents longer than this many bytes are refused as soon as the
+    // excess arrives, before it is tokenized
+    size_t max_size = std::numeric_limits<size_t>::max();
+
+#if defined(JSON_STATS)
+    // Counters to update while parsing; not synchronized, so parse_lines
+    // then runs on one thread
+    JSON_Parse_Stats *stats = nullptr;
+#endif
+};
+
+struct JSON_Write_Options
+{
+    // Spaces per nesting level, with one member or element per line; 0 writes
+    // compact output
+    unsigned indent = 0;
+
+    // Write object members in key order instead of insertion order
+    bool sort_keys = false;
+};
+
 struct JSON_Value;
 struct JSON_Parser
 {
+    static JSON_Value parse(std::string_view input);
+    static JSON_Value parse(std::string_view input, std::pmr::memory_resource *resource);
+    static JSON_Value parse(std::string_view input, const JSON_Parse_Options& options,
+                            std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+    static JSON_Value parse(const char *data, size_t size);
     static JSON_Value parse(std::istringstream&& isstream);
     static JSON_Value parse(const std::string& str);
     static JSON_Value parse(const char *c_str);
+
+    // Parses a file through a read-only memory mapping, without copying it
+    // first. To keep borrowed strings pointing into the file, parse the view
+    // of a JSON_Mapped_File that outlives the tree instead.
+    static JSON_Value parse_file(const char *path, std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    // Drives handler with the events of input instead of building a tree (see
+    // JSON_Handler). Returns false if the handler stopped the parse.
+    template <typename Handler>
+    static bool read(std::string_view input, Handler& handler, const JSON_Parse_Options& options = {});
+
+    // Decodes input straight into a T bound with JSON_BIND, without building
+    // a tree. Unknown keys are skipped and missing ones keep T's defaults;
+    // throws JSON_Error when a value does not fit its member.
+    template <typename T>
+    static T decode(std::string_view input);
+
+    // Newline-delimited JSON: one document per line, blank lines skipped.
+    // Lines are parsed on up to threads threads (0 uses every core) and come
+    // back in input order; stream_lines hands each one to callback on the
+    // calling thread instead of collecting them.
+    static std::vector<JSON_Value> parse_lines(std::string_view input, unsigned threads = 0,
+                                               const JSON_Parse_Options& options = {});
+    template <typename Callback>
+    static void stream_lines(std::string_view input, Callback&& callback, unsigned threads = 0,
+                             const JSON_Parse_Options& options = {});
+};
+
+// All storage goes through std::pmr so a whole tree can be placed in one arena
+// (see JSON_Document); by default it uses the global heap like any std container.
+using JSON_String  = std::pmr::string;
+using JSON_Array   = std::pmr::vector<JSON_Value>;
+
+// Object key. Keys normally own their characters; keys parsed with
+// JSON_Parse_Options::borrow_strings refer into the input buffer instead.
+struct JSON_Key
+{
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+    JSON_Key(std::string_view str, const allocator_type& allocator = {}) : owned(str, allocator) {}
+    JSON_Key(const char *str, const allocator_type& allocator = {}) : owned(str, allocator) {}
+    JSON_Key(const std::string& str, const allocator_type& allocator = {}) : owned(str, allocator) {}
+    JSON_Key(const JSON_Key&) = default;
+    JSON_Key(JSON_Key&&) = default;
+    JSON_Key(const JSON_Key& other, const allocator_type& allocator) : owned(other.owned, allocator), view(other.view) {}
+    JSON_Key(JSON_Key&& other, const allocator_type& allocator) : owned(std::move(other.owned), allocator), view(other.view) {}
+    JSON_Key& operator=(const JSON_Key&) = default;
+    JSON_Key& operator=(JSON_Key&&) = default;
+
+    static JSON_Key borrow(std::string_view str)
+    {
+        JSON_Key key;
+        key.view = str;
+        return key;
+    }
+
+    bool borrowed() const
+    {
+        return view.data() != nullptr;
+    }
+
+    std::string_view str() const
+    {
+        return borrowed() ? view : std::string_view(owned);
+    }
+
+    operator std::string_view() const
+    {
+        return str();
+    }
+
+private:
+    JSON_Key() = default;
+
+    JSON_String owned;
+    std::string_view view; // only set for borrowed keys
+};
+
+// Insertion-ordered object storage. Members sit in one contiguous vector and
+// small objects are searched linearly; past index_threshold members a hash
+// table of member positions is kept next to them. Keys must not be changed
+// through iterators.
+struct JSON_Object
+{
+    using value_type     = std::pair<JSON_Key, JSON_Value>;
+    using allocator_type = std::pmr::polymorphic_allocator<value_type>;
+    using iterator       = std::pmr::vector<value_type>::iterator;
+    using const_iterator = std::pmr::vector<value_type>::const_iterator;
+
+    static constexpr size_t index_threshold = 16;
+
+    JSON_Object() = default;
+    explicit JSON_Object(const allocator_type& allocator) : members(allocator), index(allocator) {}
+    JSON_Object(std::initializer_list<value_type> init, const allocator_type& allocator = {});
+
+    allocator_type get_allocator() const { return members.get_allocator(); }
+
+    size_t size() const { return members.size(); }
+    bool empty() const { return members.empty(); }
+    void reserve(size_t size) { members.reserve(size); }
+    void clear();
+
+    iterator begin() { return members.begin(); }
+    iterator end() { return members.end(); }
+    const_iterator begin() const { return members.begin(); }
+    const_iterator end() const { return members.end(); }
+
+    iterator find(std::string_view key);
+    const_iterator find(std::string_view key) const;
+    bool contains(std::string_view key) const;
+
+    // Lookup with a precomputed hash(key), for keys searched repeatedly
+    static size_t hash(std::string_view key) { return std::hash<std::string_view>{}(key); }
+    iterator find(std::string_view key, size_t hash);
+    const_iterator find(std::string_view key, size_t hash) const;
+
+    JSON_Value& at(std::string_view key);
+    const JSON_Value& at(std::string_view key) const;
+    JSON_Value& operator[](std::string_view key);
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(JSON_Key&& key, Args&&... args);
+    template <typename Value>
+    std::pair<iterator, bool> insert_or_assign(std::string_view key, Value&& value);
+    size_t erase(std::string_view key);
+
+private:
+    size_t find_position(std::string_view key) const; // size() when missing
+    size_t find_position(std::string_view key, size_t hash) const;
+    void index_member(size_t position);
+    void rebuild_index();
+
+    std::pmr::vector<value_type> members;
+    std::pmr::vector<uint32_t> index; // position + 1 per slot, 0 marks an empty slot
+};
+
+using JSON_Variant = std::variant<bool, double, JSON_String, JSON_Array, JSON_Object, std::monostate, std::string_view,
+                                  int64_t, uint64_t, std::string>;
+
+// JSON type of each JSON_Variant alternative
+constexpr JSON_Type json_variant_types[] = {
+    JSON_Type::BOOLEAN,
+    JSON_Type::NUMBER,
+    JSON_Type::STRING,
+    JSON_Type::ARRAY,
+    JSON_Type::OBJECT,
+    JSON_Type::NIL,
+    JSON_Type::STRING, // borrowed from the input
+    JSON_Type::NUMBER, // integers are kept exact when they fit 64 bits
+    JSON_Type::NUMBER,
+    JSON_Type::STRING, // moved in from a std::string, keeping its buffer
 };
 
-using JSON_Object  = std::map<std::string, JSON_Value>;
-using JSON_Array   = std::vector<JSON_Value>;
-using JSON_Variant = std::variant<bool, double, std::string, JSON_Array, JSON_Object, std::monostate>;
+// Serialization appends to a single caller-supplied buffer: anything with
+// push_back(char) and append(const char*, size_t), such as std::string.
+
+static const char *json_scan_escape(const char *p, const char *end);
+static size_t json_utf8_sequence(const char *p, const char *end);
+
+// Appends str as a quoted JSON string, escaping what JSON requires. Clean
+// ASCII runs are found with SIMD and copied in bulk; bytes that are not valid
+// UTF-8 are written as U+FFFD so the output always is.
+template <typename Buffer>
+static void json_write_string(Buffer& out, std::string_view str)
+{
+    static const char hex[] = "0123456789abcdef";
+    out.push_back('"');
+    const char *p = str.data();
+    const char *end = p + str.size();
+    while (p < end)
+    {
+        const char *run = p;
+        p = json_scan_escape(p, end);
+        out.append(run, p - run);
+        if (p == end)
+        {
+            break;
+        }
+        if (static_cast<unsigned char>(*p) >= 0x80)
+        {
+            size_t size = json_utf8_sequence(p, end);
+            if (size > 0)
+            {
+                out.append(p, size);
+                p += size;
+            }
+            else
+            {
+                out.append("\\ufffd", 6);
+                p++;
+            }
+            continue;
+        }
+        char c = *p++;
+        switch (c)
+        {
+            case '"':  out.append("\\\"", 2); break;
+            case '\\': out.append("\\\\", 2); break;
+            case '\b': out.append("\\b", 2); break;
+            case '\f': out.append("\\f", 2); break;
+            case '\n': out.append("\\n", 2); break;
+            case '\r': out.append("\\r", 2); break;
+            case '\t': out.append("\\t", 2); break;
+            default: {
+                char escape[] = {'\\', 'u', '0', '0', hex[(c >> 4) & 0xF], hex[c & 0xF]};
+                out.append(escape, sizeof(escape));
+            }
+        }
+    }
+    out.push_back('"');
+}
+
+template <typename Buffer, typename Number>
+static void json_write_number(Buffer& out, Number number)
+{
+    if constexpr (std::is_floating_point_v<Number>)
+    {
+        // JSON has no representation for these
+        if (!std::isfinite(number))
+        {
+            out.append("null", 4);
+            return;
+        }
+    }
+    char digits[32];
+    char *end = std::to_chars(digits, digits + sizeof(digits), number).ptr;
+    out.append(digits, end - digits);
+}
 
 struct JSON_Value
 {
@@ -38,7 +487,7 @@ struct JSON_Value
     
     constexpr JSON_Type type() const
     {
-        return static_cast<JSON_Type>(value.index());
+        return json_variant_types[value.index()];
     }
     
     bool boolean() const
@@ -50,13 +499,67 @@ struct JSON_Value
     double number() const
     {
         assert(type() == JSON_Type::NUMBER);
+        if (const int64_t *integer = std::get_if<int64_t>(&value))
+        {
+            return static_cast<double>(*integer);
+        }
+        if (const uint64_t *integer = std::get_if<uint64_t>(&value))
+        {
+            return static_cast<double>(*integer);
+        }
         return std::get<double>(value);
     }
     
+    bool is_int64() const
+    {
+        const uint64_t *large = std::get_if<uint64_t>(&value);
+        return std::holds_alternative<int64_t>(value) ||
+               (large && *large <= static_cast<uint64_t>(std::numeric_limits<int64_t>::max()));
+    }
+    
+    bool is_uint64() const
+    {
+        const int64_t *small = std::get_if<int64_t>(&value);
+        return std::holds_alternative<uint64_t>(value) || (small && *small >= 0);
+    }
+    
+    int64_t int64() const
+    {
+        assert(is_int64());
+        if (const uint64_t *large = std::get_if<uint64_t>(&value))
+        {
+            return static_cast<int64_t>(*large);
+        }
+        return std::get<int64_t>(value);
+    }
+    
+    uint64_t uint64() const
+    {
+        assert(is_uint64());
+        if (const int64_t *small = std::get_if<int64_t>(&value))
+        {
+            return static_cast<uint64_t>(*small);
+        }
+        return std::get<uint64_t>(value);
+    }
+    
     std::string string() const
+    {
+        return std::string(string_view());
+    }
+    
+    std::string_view string_view() const
     {
         assert(type() == JSON_Type::STRING);
-        return std::get<std::string>(value);
+        if (const std::string_view *borrowed = std::get_if<std::string_view>(&value))
+        {
+            return *borrowed;
+        }
+        if (const std::string *moved = std::get_if<std::string>(&value))
+        {
+            return *moved;
+        }
+        return std::get<JSON_String>(value);
     }
     
     const JSON_Array& array() const
@@ -91,20 +594,35 @@ struct JSON_Value
     JSON_Value() : value(std::monostate{}) {}
     JSON_Value(bool boolean) : value(boolean) {}
     JSON_Value(double number) : value(number) {}
-    JSON_Value(int number) : JSON_Value(static_cast<double>(number)) {}
+    JSON_Value(int number) : value(static_cast<int64_t>(number)) {}
+    JSON_Value(int64_t number) : value(number) {}
+    JSON_Value(uint64_t number) : value(number) {}
     JSON_Value(float number) : JSON_Value(static_cast<double>(number)) {}
     JSON_Value(const JSON_Array &array) : value(array) {}
+    JSON_Value(JSON_Array &&array) : value(std::move(array)) {}
     JSON_Value(const JSON_Object &object) : value(object) {}
-    JSON_Value(const char *cstr) : value(std::string(cstr)) {}
-    JSON_Value(const std::string& str) : value(str) {}
+    JSON_Value(JSON_Object &&object) : value(std::move(object)) {}
+    JSON_Value(JSON_String &&str) : value(std::move(str)) {}
+    JSON_Value(const char *cstr) : value(JSON_String(cstr)) {}
+    JSON_Value(const std::string& str) : value(JSON_String(str)) {}
+    JSON_Value(std::string &&str) : value(std::move(str)) {}
+
+    JSON_Value(const JSON_Value&) = default;
+    JSON_Value(JSON_Value&&) = default;
+    JSON_Value& operator=(const JSON_Value&) = default;
+    JSON_Value& operator=(JSON_Value&&) = default;
+
+    // Deeply nested containers are torn down through a work list rather than
+    // by recursion, so any depth can be destroyed
+    ~JSON_Value();
     
-    JSON_Value& operator[](const std::string& key)
+    JSON_Value& operator[](std::string_view key)
     {
         assert(type() == JSON_Type::OBJECT);
         return std::get<JSON_Object>(value)[key];
     }
 
-    const JSON_Value& operator[](const std::string& key) const
+    const JSON_Value& operator[](std::string_view key) const
     {
         assert(type() == JSON_Type::OBJECT);
         return std::get<JSON_Object>(value).at(key);
@@ -122,6 +640,20 @@ struct JSON_Value
         return std::get<JSON_Array>(value).at(index);
     }
     
+    // Builds the new element in place at the end of the array
+    template <typename... Args>
+    JSON_Value& emplace_back(Args&&... args)
+    {
+        return array().emplace_back(std::forward<Args>(args)...);
+    }
+    
+    // Stores a value built from args under key, replacing any earlier one
+    template <typename... Args>
+    JSON_Value& emplace(std::string_view key, Args&&... args)
+    {
+        return object().insert_or_assign(key, JSON_Value(std::forward<Args>(args)...)).first->second;
+    }
+    
     JSON_Value& operator=(const std::monostate& nil)
     {
         value = nil;
@@ -141,7 +673,19 @@ struct JSON_Value
     }
     
     JSON_Value& operator=(int number) {
-        value = static_cast<double>(number);
+        value = static_cast<int64_t>(number);
+        return *this;
+    }
+    
+    JSON_Value& operator=(int64_t number)
+    {
+        value = number;
+        return *this;
+    }
+    
+    JSON_Value& operator=(uint64_t number)
+    {
+        value = number;
         return *this;
     }
     
@@ -151,67 +695,134 @@ struct JSON_Value
         return *this;
     }
     
+    JSON_Value& operator=(JSON_Array &&array)
+    {
+        value = std::move(array);
+        return *this;
+    }
+    
     JSON_Value& operator=(const JSON_Object &object)
     {
         value = object;
         return *this;
     }
     
+    JSON_Value& operator=(JSON_Object &&object)
+    {
+        value = std::move(object);
+        return *this;
+    }
+    
+    JSON_Value& operator=(JSON_String &&str)
+    {
+        value = std::move(str);
+        return *this;
+    }
+    
     JSON_Value& operator=(const std::string& str)
     {
-        value = str;
+        value = JSON_String(str);
+        return *this;
+    }
+    
+    JSON_Value& operator=(std::string &&str)
+    {
+        value = std::move(str);
         return *this;
     }
     
     JSON_Value& operator=(const char *cstr)
     {
-        value = std::string(cstr);
+        value = JSON_String(cstr);
         return *this;
     }
     
     std::string to_string() const
     {
-        switch (type())
-        {
-            case JSON_Type::BOOLEAN:
-                return std::format("{}", boolean());
-            case JSON_Type::NUMBER:
-                return std::format("{}", number());
-            case JSON_Type::STRING:
-                return std::format("\"{}\"", string());
-            case JSON_Type::ARRAY: {
-                std::stringstream ss;
-                ss << "[";
-                for (const auto& v : array())
-                {
-                    ss << v.to_string() << ",";
-                }
-                std::string buffer = ss.str();
-                if (buffer.size() > 1)
-                {
-                    buffer.pop_back();
-                }
-                return buffer + "]";
-            }
-            case JSON_Type::OBJECT: {
-                std::stringstream ss;
-                ss << "{";
-                for (const auto& [k, v] : object())
-                {
-                    ss << std::quoted(k) << ":" << v.to_string() << ",";
-                }
-                std::string buffer = ss.str();
-                if (buffer.size() > 1)
-                {
-                    buffer.pop_back();
-                }
-                return buffer + "}";
-            }
-            default:
-                return "null";
-        };
+        std::string out;
+        write(out);
+        return out;
+    }
+    
+    // Appends the serialized value to out, e.g. a std::string reused across calls
+    template <typename Buffer>
+    void write(Buffer& out) const;
+
+    template <typename Buffer>
+    void write(Buffer& out, const JSON_Write_Options& options) const;
+
+    std::string to_string(const JSON_Write_Options& options) const
+    {
+        std::string out;
+        write(out, options);
+        return out;
     }
+
+    // Streams the serialized value through a fixed-size buffer (see
+    // JSON_Stream_Buffer), so memory use does not grow with the output.
+    // Throws std::system_error when the descriptor or FILE* fails; a stream
+    // reports failure through its state.
+#if defined(JSON_HAS_MMAP)
+    void write_to(int fd, const JSON_Write_Options& options = {}) const;
+#endif
+    void write_to(FILE *file, const JSON_Write_Options& options = {}) const;
+    void write_to(std::ostream& stream, const JSON_Write_Options& options = {}) const;
     
+    // Serializes on up to threads threads (0 uses every core). Wide arrays and
+    // objects are cut into runs of children that workers write into their own
+    // pieces; concatenated in order the pieces are the to_string() output.
+    // Only pays off for large trees.
+    std::string to_string_parallel(unsigned threads = 0) const;
+    void write_parallel(std::vector<std::string>& pieces, unsigned threads = 0) const;
+#if defined(JSON_HAS_MMAP)
+    // Writes the pieces to fd with writev; throws std::system_error
+    void write_parallel(int fd, unsigned threads = 0) const;
+#endif
+
+    // Replays the tree as reader events (see JSON_Handler), e.g. to build
+    // another representation from it. Returns false if the handler stopped.
+    template <typename Handler>
+    bool emit(Handler& handler) const;
+
+    // CBOR (RFC 8949) encoding. Integers keep their exact type and containers
+    // are length-prefixed, so decoding reserves them at their final size.
+    std::string to_cbor() const
+    {
+        std::string out;
+        write_cbor(out);
+        return out;
+    }
+
+    template <typename Buffer>
+    void write_cbor(Buffer& out) const;
+
+    // Decodes one CBOR data item; throws JSON_Error for malformed data and for
+    // items JSON cannot represent, such as byte strings. The depth and size
+    // limits of options apply as they do to text.
+    static JSON_Value from_cbor(std::string_view data,
+                                std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+    static JSON_Value from_cbor(std::string_view data, const JSON_Parse_Options& options,
+                                std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    // Deep equality: numbers compare by value, so 1 equals 1.0, and objects
+    // compare their members in any order
+    bool operator==(const JSON_Value& other) const;
+
+    // The JSON Patch (RFC 6902) that turns from into to, as an array of
+    // operations. Arrays are compared element by element once a common prefix
+    // and suffix are trimmed, so edits in the middle stay local.
+    static JSON_Value diff(const JSON_Value& from, const JSON_Value& to);
+
+    // Applies a JSON Patch (RFC 6902) to this value in place. Throws
+    // JSON_Patch_Error naming the failing operation, which has no effect; the
+    // operations before it stay applied, so patch a copy when the change has
+    // to be all or nothing.
+    void apply_patch(const JSON_Value& patch);
+
+    // Applies a JSON Merge Patch (RFC 7396) in place: null members delete
+    // keys, objects merge recursively and anything else replaces the target
+    void merge_patch(const JSON_Value& patch);
+
     std::string type_name() const
     {
         switch (type())
@@ -236,170 +847,7620 @@ struct JSON_Value
         return JSON_Parser::parse(std::move(isstream));
     }
     
+    static JSON_Value parse(std::string_view input)
+    {
+        return JSON_Parser::parse(input);
+    }
+    
     static JSON_Value parse(const std::string& str)
     {
-        return JSON_Parser::parse(std::istringstream(str));
+        return JSON_Parser::parse(str);
     }
     
     static JSON_Value parse(const char *c_str)
     {
-        return JSON_Parser::parse(std::string(c_str));
+        return JSON_Parser::parse(c_str);
     }
 };
 
-JSON_Value JSON_Parser::parse(std::istringstream&& isstream)
+inline JSON_Object::JSON_Object(std::initializer_list<value_type> init, const allocator_type& allocator)
+    : JSON_Object(allocator)
 {
-    JSON_Value root;
-    std::stack<JSON_Value*> stack;
-    stack.push(&root);
-        
-    std::string key;
-    JSON_Type token_type = JSON_Type::NIL;
-    size_t token_size = 0;
-    std::stringstream token_buff;
+    reserve(init.size());
+    for (const auto& [key, value] : init)
+    {
+        if (!contains(key))
+        {
+            (*this)[key] = value;
+        }
+    }
+}
+
+inline void JSON_Object::clear()
+{
+    members.clear();
+    index.clear();
+}
+
+// Interned keys are equal exactly when their pointers are, so a lookup with
+// a key from the same JSON_Key_Table skips the character comparison
+static bool json_same_key(std::string_view a, std::string_view b)
+{
+    return (a.data() == b.data() && a.size() == b.size()) || a == b;
+}
 
-    char c;
-    while (isstream.read(&c, 1))
+inline size_t JSON_Object::find_position(std::string_view key) const
+{
+    return find_position(key, index.empty() ? 0 : hash(key));
+}
+
+inline size_t JSON_Object::find_position(std::string_view key, size_t hash) const
+{
+    if (index.empty())
     {
-        switch (c)
+        for (size_t i = 0; i < members.size(); i++)
         {
-            case '{': {
-                switch (stack.top()->type())
-                {
-                    case JSON_Type::ARRAY: {
-                        JSON_Value& value = stack.top()->array().emplace_back(JSON_Object{});
-                        stack.push(&value);
-                        break;
-                    }
-                    case JSON_Type::OBJECT: {
-                        assert(!key.empty());
-                        stack.top()->object()[key] = JSON_Value(JSON_Object{});
-                        JSON_Value& value = stack.top()->object()[key];
-                        stack.push(&value);
-                        break;
-                    }
-                    default:
-                        *stack.top() = JSON_Object{};
-                };
-                continue;
+            if (json_same_key(members[i].first, key))
+            {
+                return i;
             }
-            case '[': {        
-                switch (stack.top()->type())
-                {
-                    case JSON_Type::ARRAY: {
-                        JSON_Value& value = stack.top()->array().emplace_back(JSON_Array{});
-                        stack.push(&value);
-                        break;
-                    }
-                    case JSON_Type::OBJECT: {
-                        assert(!key.empty());
-                        stack.top()->object()[key] = JSON_Value(JSON_Array{});
-                        JSON_Value& value = stack.top()->object()[key];
-                        stack.push(&value);
-                        break;
-                    }
-                    default:
-                        *stack.top() = JSON_Array{};
-                };
-                continue;
+        }
+        return members.size();
+    }
+
+    size_t mask = index.size() - 1;
+    for (size_t slot = hash & mask; index[slot] != 0; slot = (slot + 1) & mask)
+    {
+        size_t position = index[slot] - 1;
+        if (json_same_key(members[position].first, key))
+        {
+            return position;
+        }
+    }
+    return members.size();
+}
+
+inline void JSON_Object::index_member(size_t position)
+{
+    if (members.size() <= index_threshold)
+    {
+        return;
+    }
+    // Keep the table at most half full
+    if (members.size() * 2 > index.size())
+    {
+        rebuild_index();
+        return;
+    }
+    size_t mask = index.size() - 1;
+    size_t slot = hash(members[position].first) & mask;
+    while (index[slot] != 0)
+    {
+        slot = (slot + 1) & mask;
+    }
+    index[slot] = static_cast<uint32_t>(position + 1);
+}
+
+inline void JSON_Object::rebuild_index()
+{
+    if (members.size() <= index_threshold)
+    {
+        index.clear();
+        return;
+    }
+    index.assign(std::bit_ceil(members.size() * 4), 0);
+    size_t mask = index.size() - 1;
+    for (size_t position = 0; position < members.size(); position++)
+    {
+        size_t slot = hash(members[position].first) & mask;
+        while (index[slot] != 0)
+        {
+            slot = (slot + 1) & mask;
+        }
+        index[slot] = static_cast<uint32_t>(position + 1);
+    }
+}
+
+inline JSON_Object::iterator JSON_Object::find(std::string_view key)
+{
+    return members.begin() + find_position(key);
+}
+
+inline JSON_Object::const_iterator JSON_Object::find(std::string_view key) const
+{
+    return members.begin() + find_position(key);
+}
+
+inline JSON_Object::iterator JSON_Object::find(std::string_view key, size_t hash)
+{
+    return members.begin() + find_position(key, hash);
+}
+
+inline JSON_Object::const_iterator JSON_Object::find(std::string_view key, size_t hash) const
+{
+    return members.begin() + find_position(key, hash);
+}
+
+inline bool JSON_Object::contains(std::string_view key) const
+{
+    return find_position(key) != members.size();
+}
+
+inline JSON_Value& JSON_Object::at(std::string_view key)
+{
+    size_t position = find_position(key);
+    if (position == members.size())
+    {
+        throw std::out_of_range("JSON_Object::at");
+    }
+    return members[position].second;
+}
+
+inline const JSON_Value& JSON_Object::at(std::string_view key) const
+{
+    size_t position = find_position(key);
+    if (position == members.size())
+    {
+        throw std::out_of_range("JSON_Object::at");
+    }
+    return members[position].second;
+}
+
+inline JSON_Value& JSON_Object::operator[](std::string_view key)
+{
+    size_t position = find_position(key);
+    if (position == members.size())
+    {
+        members.emplace_back(key, JSON_Value());
+        index_member(position);
+    }
+    return members[position].second;
+}
+
+template <typename... Args>
+std::pair<JSON_Object::iterator, bool> JSON_Object::try_emplace(JSON_Key&& key, Args&&... args)
+{
+    size_t position = find_position(key);
+    bool inserted = position == members.size();
+    if (inserted)
+    {
+        members.emplace_back(std::piecewise_construct, std::forward_as_tuple(std::move(key)),
+                             std::forward_as_tuple(std::forward<Args>(args)...));
+        index_member(position);
+    }
+    return {members.begin() + position, inserted};
+}
+
+template <typename Value>
+std::pair<JSON_Object::iterator, bool> JSON_Object::insert_or_assign(std::string_view key, Value&& value)
+{
+    size_t position = find_position(key);
+    bool inserted = position == members.size();
+    if (inserted)
+    {
+        members.emplace_back(key, std::forward<Value>(value));
+        index_member(position);
+    }
+    else
+    {
+        members[position].second = std::forward<Value>(value);
+    }
+    return {members.begin() + position, inserted};
+}
+
+inline size_t JSON_Object::erase(std::string_view key)
+{
+    size_t position = find_position(key);
+    if (position == members.size())
+    {
+        return 0;
+    }
+    members.erase(members.begin() + position);
+    if (!index.empty())
+    {
+        rebuild_index();
+    }
+    return 1;
+}
+
+// Depth-first walk over a tree with an explicit stack instead of recursion, so
+// nesting depth is bounded by memory rather than by the call stack. The
+// visitor gets scalar(value) for each scalar, open(container) and
+// close(container) around each array or object, and child(container,
+// position) before each child, which returns the child to visit next. They
+// return false, or nullptr, to stop the walk.
+template <typename Visitor>
+static bool json_walk(const JSON_Value& root, Visitor& visitor)
+{
+    if (root.type() != JSON_Type::ARRAY && root.type() != JSON_Type::OBJECT)
+    {
+        return visitor.scalar(root);
+    }
+    struct Frame
+    {
+        const JSON_Value *container;
+        size_t size;
+        size_t next;
+    };
+    // Typical nesting fits the stack buffer
+    alignas(Frame) std::byte initial[32 * sizeof(Frame)];
+    std::pmr::monotonic_buffer_resource arena(initial, sizeof(initial));
+    std::pmr::vector<Frame> stack(&arena);
+    stack.reserve(32);
+    const JSON_Value *value = &root;
+    while (true)
+    {
+        if (value->type() == JSON_Type::ARRAY || value->type() == JSON_Type::OBJECT)
+        {
+            if (!visitor.open(*value))
+            {
+                return false;
             }
-            case ':': {
-                assert(token_type == JSON_Type::STRING);
-                assert(token_size > 0);
-
-                key = token_buff.str();
-                // std::cout << "key: " << key << '\t' << (int)token_type << std::endl;
-                token_buff = std::stringstream{};
-                token_size = 0;
-                token_type = JSON_Type::NIL;
-                continue;
+            size_t size = value->type() == JSON_Type::ARRAY ? value->array().size() : value->object().size();
+            stack.push_back({value, size, 0});
+        }
+        else if (!visitor.scalar(*value))
+        {
+            return false;
+        }
+        while (stack.back().next == stack.back().size)
+        {
+            const JSON_Value& container = *stack.back().container;
+            stack.pop_back();
+            if (!visitor.close(container))
+            {
+                return false;
             }
-            case '}':
-            case ']':
-            case ',': {
-                if (token_size > 0)
-                {
-                    std::string token = token_buff.str();
-                    if (token == "true" || token == "false")
+            if (stack.empty())
+            {
+                return true;
+            }
+        }
+        Frame& top = stack.back();
+        value = visitor.child(*top.container, top.next++);
+        if (!value)
+        {
+            return false;
+        }
+    }
+}
+
+template <typename Buffer>
+static void json_write_scalar(Buffer& out, const JSON_Value& value)
+{
+    switch (value.type())
+    {
+        case JSON_Type::BOOLEAN:
+            if (value.boolean())
+            {
+                out.append("true", 4);
+            }
+            else
+            {
+                out.append("false", 5);
+            }
+            break;
+        case JSON_Type::NUMBER:
+            if (const int64_t *integer = std::get_if<int64_t>(&value.value))
+            {
+                json_write_number(out, *integer);
+            }
+            else if (const uint64_t *integer = std::get_if<uint64_t>(&value.value))
+            {
+                json_write_number(out, *integer);
+            }
+            else
+            {
+                json_write_number(out, std::get<double>(value.value));
+            }
+            break;
+        case JSON_Type::STRING:
+            json_write_string(out, value.string_view());
+            break;
+        default:
+            out.append("null", 4);
+    }
+}
+
+template <typename Buffer>
+void JSON_Value::write(Buffer& out) const
+{
+    struct Writer
+    {
+        Buffer& out;
+
+        bool scalar(const JSON_Value& value)
+        {
+            json_write_scalar(out, value);
+            return true;
+        }
+
+        bool open(const JSON_Value& container)
+        {
+            out.push_back(container.type() == JSON_Type::ARRAY ? '[' : '{');
+            return true;
+        }
+
+        bool close(const JSON_Value& container)
+        {
+            out.push_back(container.type() == JSON_Type::ARRAY ? ']' : '}');
+            return true;
+        }
+
+        const JSON_Value *child(const JSON_Value& container, size_t position)
+        {
+            if (position > 0)
+            {
+                out.push_back(',');
+            }
+            if (container.type() == JSON_Type::ARRAY)
+            {
+                return &container.array()[position];
+            }
+            const auto& [key, member] = container.object().begin()[position];
+            json_write_string(out, key);
+            out.push_back(':');
+            return &member;
+        }
+    };
+    Writer writer{out};
+    json_walk(*this, writer);
+}
+
+template <typename Handler>
+bool JSON_Value::emit(Handler& handler) const
+{
+    struct Emitter
+    {
+        Handler& handler;
+
+        bool scalar(const JSON_Value& value)
+        {
+            switch (value.type())
+            {
+                case JSON_Type::BOOLEAN:
+                    return handler.on_bool(value.boolean());
+                case JSON_Type::NUMBER:
+                    if (const int64_t *integer = std::get_if<int64_t>(&value.value))
                     {
-                        token_type = JSON_Type::BOOLEAN;
+                        return handler.on_int64(*integer);
                     }
-                        
-                    // std::cout << "token: " << token << '\t' << token_size << '\t' << (int)token_type << std::endl;
-                        
-                    JSON_Value value;
-                    switch (token_type)
-                    {
-                        case JSON_Type::BOOLEAN:
-                            value = token == "true";
-                            break;
-                        case JSON_Type::NUMBER:
-                            value = std::stod(token);
-                            break;
-                        case JSON_Type::STRING:
-                            value = token;
-                            break;
-                        default:
-                            value = std::monostate{};
-                    };
-
-                    switch (stack.top()->type())
+                    if (const uint64_t *integer = std::get_if<uint64_t>(&value.value))
                     {
-                        case JSON_Type::ARRAY:
-                            stack.top()->array().push_back(value);
-                            break;
-                        case JSON_Type::OBJECT:
-                            assert(!key.empty());
-                            stack.top()->object()[key] = value;
-                            break;
-                        default:
-                            break;
-                    };
-                    
-                    token_buff = std::stringstream{};
-                    token_size = 0;
-                    token_type = JSON_Type::NIL;
-                }
-                else // '}' or ']' case
-                {
-                    stack.pop();
-                }
-                continue;
+                        return handler.on_uint64(*integer);
+                    }
+                    return handler.on_number(std::get<double>(value.value));
+                case JSON_Type::STRING:
+                    return handler.on_string(value.string_view(), false);
+                default:
+                    return handler.on_null();
             }
-            case '"': {
-                token_type = JSON_Type::STRING;
-                continue;
+        }
+
+        bool open(const JSON_Value& container)
+        {
+            return container.type() == JSON_Type::ARRAY ? handler.on_array_begin() : handler.on_object_begin();
+        }
+
+        bool close(const JSON_Value& container)
+        {
+            return container.type() == JSON_Type::ARRAY ? handler.on_array_end() : handler.on_object_end();
+        }
+
+        const JSON_Value *child(const JSON_Value& container, size_t position)
+        {
+            if (container.type() == JSON_Type::ARRAY)
+            {
+                return &container.array()[position];
             }
+            const auto& [key, member] = container.object().begin()[position];
+            return handler.on_key(key, false) ? &member : nullptr;
         }
+    };
+    Emitter emitter{handler};
+    return json_walk(*this, emitter);
+}
 
-        token_buff << c;
-        token_size++;
-        
-        if (std::isdigit(c) && token_type != JSON_Type::STRING)
+// Children that are non-empty containers move to pending, so that destroying
+// value itself recurses no further than its direct children
+static void json_detach_nested(JSON_Value& value, std::vector<JSON_Value>& pending)
+{
+    auto detach = [&](JSON_Value& child) {
+        if ((child.type() == JSON_Type::ARRAY && !child.array().empty()) ||
+            (child.type() == JSON_Type::OBJECT && !child.object().empty()))
         {
-            token_type = JSON_Type::NUMBER;
+            pending.push_back(std::move(child));
         }
-        
-        if (!std::isdigit(c) && token_type == JSON_Type::NUMBER)
+    };
+    if (JSON_Array *elements = std::get_if<JSON_Array>(&value.value))
+    {
+        for (JSON_Value& element : *elements)
+        {
+            detach(element);
+        }
+    }
+    else if (JSON_Object *members = std::get_if<JSON_Object>(&value.value))
+    {
+        for (auto& [key, member] : *members)
         {
-            token_type = JSON_Type::NIL;
+            detach(member);
         }
-        // std::cout << c << std::endl;
     }
-        
-    return root;
 }
-    
-JSON_Value JSON_Parser::parse(const std::string& str)
+
+// The first levels are destroyed by plain recursion, which costs nothing
+// extra for ordinary trees; only containers deeper than that go through the
+// work list
+inline JSON_Value::~JSON_Value()
 {
-    return JSON_Parser::parse(std::istringstream(str));
+    static constexpr unsigned recursion_limit = 64;
+    static thread_local unsigned depth = 0;
+    if (type() != JSON_Type::ARRAY && type() != JSON_Type::OBJECT)
+    {
+        return;
+    }
+    if (depth < recursion_limit)
+    {
+        depth++;
+        value.emplace<std::monostate>();
+        depth--;
+        return;
+    }
+    std::vector<JSON_Value> pending;
+    try
+    {
+        json_detach_nested(*this, pending);
+        while (!pending.empty())
+        {
+            JSON_Value doomed = std::move(pending.back());
+            pending.pop_back();
+            json_detach_nested(doomed, pending);
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        // No memory for the work list: whatever is left is destroyed recursively
+    }
 }
-    
-JSON_Value JSON_Parser::parse(const char *c_str)
+
+// Owns a parsed tree together with the arena it was allocated from. Every node
+// the parser creates lives in the arena, so a document that has only been read
+// is dropped by releasing the arena in one go, without visiting its nodes. Once
+// the tree has been handed out for mutation it may also reference heap memory
+// and is torn down the usual way before the arena is released.
+struct JSON_Document
 {
-    return JSON_Parser::parse(std::string(c_str));
-}
- 
+    JSON_Document()
+    {
+        new (&tree) JSON_Value();
+    }
+
+    // Starts the arena in a caller-supplied buffer, e.g. one reused per request
+    JSON_Document(void *buffer, size_t size) : arena(buffer, size)
+    {
+        new (&tree) JSON_Value();
+    }
+
+    explicit JSON_Document(std::string_view input) : JSON_Document()
+    {
+        parse(input);
+    }
+
+    JSON_Document(const JSON_Document&) = delete;
+    JSON_Document& operator=(const JSON_Document&) = delete;
+
+    ~JSON_Document()
+    {
+        clear();
+        tree.~JSON_Value();
+    }
+
+    void parse(std::string_view input, const JSON_Parse_Options& options = {})
+    {
+        clear();
+        JSON_Value parsed = JSON_Parser::parse(input, options, &arena);
+        tree.value = std::move(parsed.value);
+    }
+
+    void clear()
+    {
+        if (mutated)
+        {
+            tree.~JSON_Value();
+        }
+        new (&tree) JSON_Value();
+        arena.release();
+        mutated = false;
+    }
+
+    const JSON_Value& root() const
+    {
+        return tree;
+    }
+
+    JSON_Value& root()
+    {
+        mutated = true;
+        return tree;
+    }
+
+    std::pmr::memory_resource *resource()
+    {
+        return &arena;
+    }
+
+private:
+    std::pmr::monotonic_buffer_resource arena;
+    union { JSON_Value tree; };
+    bool mutated = false;
+};
+
+// A document that can no longer change, for sharing between threads. Only
+// const access is offered and const access never touches the tree, so any
+// number of threads can read one at the same time without locking. Parsed
+// documents live in an arena like JSON_Document.
+struct JSON_Frozen_Document
+{
+    explicit JSON_Frozen_Document(std::string_view input, const JSON_Parse_Options& options = {})
+        : storage(std::in_place_type<JSON_Document>)
+    {
+        std::get<JSON_Document>(storage).parse(input, options);
+    }
+
+    // Text arguments would also convert to JSON_Value
+    explicit JSON_Frozen_Document(const char *input, const JSON_Parse_Options& options = {})
+        : JSON_Frozen_Document(std::string_view(input), options) {}
+    explicit JSON_Frozen_Document(const std::string& input, const JSON_Parse_Options& options = {})
+        : JSON_Frozen_Document(std::string_view(input), options) {}
+
+    explicit JSON_Frozen_Document(JSON_Value&& value) : storage(std::in_place_type<JSON_Value>, std::move(value)) {}
+
+    JSON_Frozen_Document(const JSON_Frozen_Document&) = delete;
+    JSON_Frozen_Document& operator=(const JSON_Frozen_Document&) = delete;
+
+    const JSON_Value& root() const
+    {
+        if (const JSON_Document *parsed = std::get_if<JSON_Document>(&storage))
+        {
+            return parsed->root();
+        }
+        return std::get<JSON_Value>(storage);
+    }
+
+    // Throw std::out_of_range like the const JSON_Value accessors
+    const JSON_Value& operator[](std::string_view key) const
+    {
+        return root()[key];
+    }
+
+    const JSON_Value& operator[](int index) const
+    {
+        return root()[index];
+    }
+
+private:
+    // Parsed text in its arena, or a tree that was handed over
+    std::variant<JSON_Document, JSON_Value> storage;
+};
+
+// The current version of a frozen document, RCU style. Readers take a
+// snapshot with load() and keep it as long as they need it, e.g. for one
+// request; publish() swaps in a new version without waiting for them.
+// Reading a snapshot involves no synchronization at all.
+//
+// The current version sits behind a mutex, as it would inside
+// std::atomic<std::shared_ptr>, which libstdc++ implements with a lock. Every
+// thread caches its snapshots of the last few documents it read, though,
+// tagged with a version counter that publishing bumps, so the mutex is taken
+// once per thread and version; any other load is an atomic load and a
+// reference count increment. Because of that cache an old version is freed
+// once every thread that read it has loaded a newer one, read enough other
+// documents to evict it, or exited.
+struct JSON_Shared_Document
+{
+    using Snapshot = std::shared_ptr<const JSON_Frozen_Document>;
+
+    JSON_Shared_Document() = default;
+    explicit JSON_Shared_Document(Snapshot initial) : current(std::move(initial)) {}
+
+    JSON_Shared_Document(const JSON_Shared_Document&) = delete;
+    JSON_Shared_Document& operator=(const JSON_Shared_Document&) = delete;
+
+    Snapshot load() const
+    {
+        // Documents are told apart by id rather than address, which a
+        // destroyed document may pass on to a new one
+        struct Cached
+        {
+            uint64_t id = 0;
+            uint64_t version = 0;
+            Snapshot snapshot;
+        };
+        static thread_local Cached cache[4];
+        static thread_local unsigned evict = 0;
+
+        uint64_t seen = version.load(std::memory_order_acquire);
+        Cached *slot = nullptr;
+        for (Cached& cached : cache)
+        {
+            if (cached.id == id)
+            {
+                if (cached.version == seen)
+                {
+                    return cached.snapshot;
+                }
+                slot = &cached;
+            }
+        }
+        if (!slot)
+        {
+            slot = &cache[evict++ % std::size(cache)];
+        }
+        // Read after the version, so the snapshot is at least that new
+        Snapshot latest;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            latest = current;
+        }
+        slot->snapshot = std::move(latest); // frees a stale version outside the lock
+        slot->id = id;
+        slot->version = seen;
+        return slot->snapshot;
+    }
+
+    void publish(Snapshot next)
+    {
+        exchange(std::move(next));
+    }
+
+    // Parses input into a new version and publishes it; on a parse error the
+    // current version stays
+    void publish(std::string_view input, const JSON_Parse_Options& options = {})
+    {
+        publish(std::make_shared<const JSON_Frozen_Document>(input, options));
+    }
+
+    // Publishes next and returns the version it replaced
+    Snapshot exchange(Snapshot next)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current.swap(next);
+        }
+        version.fetch_add(1, std::memory_order_release);
+        return next;
+    }
+
+private:
+    static uint64_t next_id()
+    {
+        static std::atomic<uint64_t> last{0};
+        return last.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    mutable std::mutex mutex;
+    Snapshot current;
+    std::atomic<uint64_t> version{0};
+    const uint64_t id = next_id(); // 0 marks an empty cache entry
+};
+
+// Read-only view of a whole file, memory-mapped where the platform allows it
+// and read into memory otherwise. Throws std::system_error if the file cannot
+// be opened.
+struct JSON_Mapped_File
+{
+    explicit JSON_Mapped_File(const char *path);
+    JSON_Mapped_File(const JSON_Mapped_File&) = delete;
+    JSON_Mapped_File& operator=(const JSON_Mapped_File&) = delete;
+    ~JSON_Mapped_File();
+
+    std::string_view view() const
+    {
+        return {data, size};
+    }
+
+private:
+    const char *data = nullptr;
+    size_t size = 0;
+#if !defined(JSON_HAS_MMAP)
+    std::string contents;
+#endif
+};
+
+// Event interface of the streaming reader. Handlers derive from this and hide
+// the events they care about; calls are resolved statically, so JSON_Reader
+// is instantiated per handler type. Returning false stops the parse.
+//
+// Strings and keys arrive decoded. in_input tells whether the view points into
+// the chunk currently being read, and so stays valid as long as that chunk
+// does; otherwise it refers to scratch storage that is reused after the call.
+struct JSON_Handler
+{
+    bool on_null() { return true; }
+    bool on_bool(bool) { return true; }
+    bool on_number(double) { return true; }
+    bool on_int64(int64_t) { return true; }
+    bool on_uint64(uint64_t) { return true; }
+    bool on_string(std::string_view, bool /* in_input */) { return true; }
+    bool on_key(std::string_view, bool /* in_input */) { return true; }
+    bool on_object_begin() { return true; }
+    bool on_object_end() { return true; }
+    bool on_array_begin() { return true; }
+    bool on_array_end() { return true; }
+};
+
+// Builds a JSON_Value tree from reader events
+struct JSON_DOM_Builder : JSON_Handler
+{
+    explicit JSON_DOM_Builder(const JSON_Parse_Options& options = {},
+                              std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+        : options(options), resource(resource) {}
+
+    bool on_null() { place(std::monostate{}); return true; }
+    bool on_bool(bool boolean) { place(boolean); return true; }
+    bool on_number(double number) { place(number); return true; }
+    bool on_int64(int64_t number) { place(number); return true; }
+    bool on_uint64(uint64_t number) { place(number); return true; }
+    bool on_string(std::string_view str, bool in_input);
+    bool on_key(std::string_view key, bool in_input);
+    bool on_object_begin();
+    bool on_object_end();
+    bool on_array_begin();
+    bool on_array_end();
+
+    // Capacity hint for the container opened last, e.g. from a schema
+    void reserve(size_t size);
+
+    // Hands out the finished tree and gets ready for the next document
+    JSON_Value release();
+
+private:
+    JSON_Value& place(JSON_Variant&& value);
+
+    JSON_Parse_Options options;
+    std::pmr::memory_resource *resource;
+
+    JSON_Value root;
+    std::vector<JSON_Value*> stack;
+    JSON_Value *member = nullptr; // slot created by the last key
+};
+
+// Resumable tokenizer. Input may arrive in arbitrary chunks: tokens are read
+// straight from the chunk passed to feed() and only a token that straddles
+// two chunks is copied.
+template <typename Handler>
+struct JSON_Reader
+{
+    explicit JSON_Reader(Handler& handler, const JSON_Parse_Options& options = {})
+        : handler(handler), max_depth(options.max_depth), max_size(options.max_size)
+    {
+#if defined(JSON_STATS)
+        stats = options.stats;
+#endif
+    }
+
+    // Consumes the next chunk; throws JSON_Error on malformed input. Returns
+    // false once the handler has stopped the parse.
+    bool feed(const char *data, size_t size);
+
+    bool feed(std::string_view chunk)
+    {
+        return feed(chunk.data(), chunk.size());
+    }
+
+    // Ends the input; throws JSON_Error if the document is incomplete
+    bool finish();
+
+    // Whether a complete root value has been read. A bare number at the root
+    // only completes in finish(), since more digits may follow.
+    bool done() const
+    {
+        return expect == Expect::END;
+    }
+
+    // Bytes fed so far
+    size_t offset() const
+    {
+        return consumed;
+    }
+
+    void reset();
+
+private:
+    enum class Expect { VALUE, KEY, COLON, COMMA_OR_END, END };
+    enum class Pending { NONE, STRING, LITERAL };
+
+    bool on_string(std::string_view raw, bool escaped, bool in_input, size_t offset);
+    bool on_literal(std::string_view literal, size_t offset);
+    void after_value();
+
+    // Hands an event to the handler; with JSON_STATS the event is counted and
+    // the handler's time kept apart from the tokenizer's
+    template <typename Call>
+    bool deliver(JSON_Type type, bool key, Call&& call)
+    {
+#if defined(JSON_STATS)
+        if (stats)
+        {
+            key ? stats->keys++ : stats->values[static_cast<int>(type)]++;
+        }
+        JSON_Stats_Timer timer(stats ? &stats->handler_ticks : nullptr);
+#endif
+        (void)type;
+        (void)key;
+        return call();
+    }
+
+    template <typename Call>
+    bool deliver(Call&& call)
+    {
+#if defined(JSON_STATS)
+        JSON_Stats_Timer timer(stats ? &stats->handler_ticks : nullptr);
+#endif
+        return call();
+    }
+
+    Handler& handler;
+    size_t max_depth;
+    size_t max_size;
+#if defined(JSON_STATS)
+    JSON_Parse_Stats *stats = nullptr;
+#endif
+
+    std::vector<bool> scopes; // true for objects
+    Expect expect = Expect::VALUE;
+    bool empty = false;       // true right after '{' or '[' so that "{}" and "[]" may close
+    bool stopped = false;
+
+    JSON_String decoded;      // strings that contained escapes
+
+    Pending pending = Pending::NONE;
+    std::string pending_token;  // the part of a straddling token seen so far
+    size_t pending_offset = 0;
+    bool pending_escaped = false;
+    bool pending_dangling = false; // the chunk ended on a '\', so the next byte is escaped
+    size_t consumed = 0;
+};
+
+// Parses a document delivered in arbitrary chunks, e.g. as it comes off a
+// socket. With borrow_strings, borrowed values point into the chunk they were
+// read from, so every chunk must then outlive the tree.
+struct JSON_Push_Parser
+{
+    explicit JSON_Push_Parser(const JSON_Parse_Options& options = {},
+                              std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+        : builder(options, resource), reader(builder, options) {}
+
+    // Consumes the next chunk; throws JSON_Error on malformed input
+    void feed(const char *data, size_t size)
+    {
+        reader.feed(data, size);
+    }
+
+    void feed(std::string_view chunk)
+    {
+        reader.feed(chunk);
+    }
+
+    // Ends the input and hands out the document; throws JSON_Error if it is incomplete
+    JSON_Value finish();
+
+    bool done() const
+    {
+        return reader.done();
+    }
+
+    size_t offset() const
+    {
+        return reader.offset();
+    }
+
+    // Abandons a half-read document, e.g. after an error, so the next chunk
+    // starts a new one. Buffers keep their capacity.
+    void reset();
+
+private:
+    JSON_DOM_Builder builder;
+    JSON_Reader<JSON_DOM_Builder> reader;
+};
+
+// Parser for many documents in a row, such as a stream of small messages.
+// The tokenizer's and tree builder's stacks and scratch strings keep their
+// capacity from one document to the next, so after a few documents parsing
+// no longer allocates anything but the tree. parse_in_arena() avoids that
+// too: trees go into an arena owned by the parser, which grows to fit the
+// largest document and is then reused as is. Not synchronized.
+struct JSON_Reusable_Parser
+{
+    explicit JSON_Reusable_Parser(const JSON_Parse_Options& options = {},
+                                  std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    JSON_Reusable_Parser(const JSON_Reusable_Parser&) = delete;
+    JSON_Reusable_Parser& operator=(const JSON_Reusable_Parser&) = delete;
+
+    // The arena tree is never mutated, so its memory goes with the arena
+    // without the tree being visited
+    ~JSON_Reusable_Parser() {}
+
+    // The tree is allocated from the resource given to the constructor and
+    // independent of the parser. Throws JSON_Error for malformed input.
+    JSON_Value parse(std::string_view input);
+
+    // The tree lives in the parser's arena and stays valid until the next
+    // parse_in_arena() or reset(). Throws JSON_Error for malformed input.
+    const JSON_Value& parse_in_arena(std::string_view input);
+
+    // Drops the arena tree; every buffer keeps its capacity
+    void reset();
+
+    // Bytes the arena keeps between documents
+    size_t arena_capacity() const
+    {
+        return capacity;
+    }
+
+private:
+    // Heap memory the arena needed beyond its buffer, which tells how far to
+    // grow the buffer on the next recycle()
+    struct Overflow_Resource : std::pmr::memory_resource
+    {
+        void *do_allocate(size_t bytes, size_t alignment) override
+        {
+            used += bytes;
+            return std::pmr::get_default_resource()->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void *p, size_t bytes, size_t alignment) override
+        {
+            std::pmr::get_default_resource()->deallocate(p, bytes, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+        {
+            return this == &other;
+        }
+
+        size_t used = 0;
+    };
+
+    static JSON_Value run(JSON_Push_Parser& parser, std::string_view input);
+    void recycle();
+
+    Overflow_Resource overflow;
+    std::unique_ptr<std::byte[]> buffer;
+    size_t capacity = 0;
+    std::optional<std::pmr::monotonic_buffer_resource> arena; // always engaged outside recycle()
+    JSON_Push_Parser heap;
+    JSON_Push_Parser in_arena;
+    union { JSON_Value tree; };
+};
+
+static bool json_is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// String bodies make up most of the input, so the parser skips them with the
+// routines below: each returns the first '"' or '\\' in [p, end), or end.
+// The serializer uses the same shape of routine to find bytes to escape and
+// the string validator to skip printable ASCII.
+static const char *json_scan_string_scalar(const char *p, const char *end)
+{
+    while (p < end && *p != '"' && *p != '\\')
+    {
+        p++;
+    }
+    return p;
+}
+
+// First '"', '\\', control character or byte outside ASCII
+static const char *json_scan_escape_scalar(const char *p, const char *end)
+{
+    while (p < end && *p != '"' && *p != '\\' && static_cast<unsigned char>(*p) >= 0x20 &&
+           static_cast<unsigned char>(*p) < 0x80)
+    {
+        p++;
+    }
+    return p;
+}
+
+// First control character or byte outside ASCII
+static const char *json_skip_text_scalar(const char *p, const char *end)
+{
+    while (p < end && static_cast<unsigned char>(*p) >= 0x20 && static_cast<unsigned char>(*p) < 0x80)
+    {
+        p++;
+    }
+    return p;
+}
+
+#if defined(__SSE2__)
+static const char *json_scan_string_sse2(const char *p, const char *end)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return json_scan_string_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *json_scan_string_avx2(const char *p, const char *end)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return json_scan_string_sse2(p, end);
+}
+
+static const char *json_scan_escape_sse2(const char *p, const char *end)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        // max(c, 0x1F) == 0x1F exactly for the control characters; or-ing in
+        // the chunk adds the bytes with their high bit set
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+                                    _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control), chunk));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return json_scan_escape_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *json_scan_escape_avx2(const char *p, const char *end)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)),
+                                       _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(chunk, control), control), chunk));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return json_scan_escape_sse2(p, end);
+}
+
+static const char *json_skip_text_sse2(const char *p, const char *end)
+{
+    const __m128i control = _mm_set1_epi8(0x1F);
+    for (; end - p >= 16; p += 16)
+    {
+        // Control characters as in json_scan_escape_sse2; the movemask of the
+        // bytes themselves is their high bits
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control), chunk);
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return json_skip_text_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *json_skip_text_avx2(const char *p, const char *end)
+{
+    const __m256i control = _mm256_set1_epi8(0x1F);
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(chunk, control), control), chunk);
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return json_skip_text_sse2(p, end);
+}
+#elif defined(__ARM_NEON)
+// Narrows each byte of a compare to a nibble so the whole result fits in 64
+// bits; returns the index of the first hit, or 16
+static unsigned json_first_hit_neon(uint8x16_t hits)
+{
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hits), 4)), 0);
+    return mask != 0 ? __builtin_ctzll(mask) >> 2 : 16;
+}
+
+static const char *json_scan_string_neon(const char *p, const char *end)
+{
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    for (; end - p >= 16; p += 16)
+    {
+        uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+        unsigned hit = json_first_hit_neon(vorrq_u8(vceqq_u8(chunk, quote), vceqq_u8(chunk, backslash)));
+        if (hit < 16)
+        {
+            return p + hit;
+        }
+    }
+    return json_scan_string_scalar(p, end);
+}
+
+static const char *json_scan_escape_neon(const char *p, const char *end)
+{
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t space = vdupq_n_u8(0x20);
+    const uint8x16_t high = vdupq_n_u8(0x80);
+    for (; end - p >= 16; p += 16)
+    {
+        uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+        uint8x16_t hits = vorrq_u8(vorrq_u8(vceqq_u8(chunk, quote), vceqq_u8(chunk, backslash)),
+                                   vorrq_u8(vcltq_u8(chunk, space), vcgeq_u8(chunk, high)));
+        unsigned hit = json_first_hit_neon(hits);
+        if (hit < 16)
+        {
+            return p + hit;
+        }
+    }
+    return json_scan_escape_scalar(p, end);
+}
+
+static const char *json_skip_text_neon(const char *p, const char *end)
+{
+    const uint8x16_t space = vdupq_n_u8(0x20);
+    const uint8x16_t high = vdupq_n_u8(0x80);
+    for (; end - p >= 16; p += 16)
+    {
+        uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+        unsigned hit = json_first_hit_neon(vorrq_u8(vcltq_u8(chunk, space), vcgeq_u8(chunk, high)));
+        if (hit < 16)
+        {
+            return p + hit;
+        }
+    }
+    return json_skip_text_scalar(p, end);
+}
+#endif
+
+using JSON_Scan_Function = const char *(*)(const char *, const char *);
+
+#if defined(__SSE2__)
+static JSON_Scan_Function json_select_scan(JSON_Scan_Function avx2, JSON_Scan_Function sse2)
+{
+    return __builtin_cpu_supports("avx2") ? avx2 : sse2;
+}
+#endif
+
+static const char *json_scan_string(const char *p, const char *end)
+{
+#if defined(__SSE2__)
+    static const JSON_Scan_Function scan = json_select_scan(json_scan_string_avx2, json_scan_string_sse2);
+    return scan(p, end);
+#elif defined(__ARM_NEON)
+    return json_scan_string_neon(p, end);
+#else
+    return json_scan_string_scalar(p, end);
+#endif
+}
+
+static const char *json_scan_escape(const char *p, const char *end)
+{
+    // Most keys and many values are shorter than a vector
+    if (end - p < 16)
+    {
+        return json_scan_escape_scalar(p, end);
+    }
+#if defined(__SSE2__)
+    static const JSON_Scan_Function scan = json_select_scan(json_scan_escape_avx2, json_scan_escape_sse2);
+    return scan(p, end);
+#elif defined(__ARM_NEON)
+    return json_scan_escape_neon(p, end);
+#else
+    return json_scan_escape_scalar(p, end);
+#endif
+}
+
+static const char *json_skip_text(const char *p, const char *end)
+{
+#if defined(__SSE2__)
+    static const JSON_Scan_Function scan = json_select_scan(json_skip_text_avx2, json_skip_text_sse2);
+    return scan(p, end);
+#elif defined(__ARM_NEON)
+    return json_skip_text_neon(p, end);
+#else
+    return json_skip_text_scalar(p, end);
+#endif
+}
+
+// Length of the well-formed UTF-8 sequence starting at p, or 0. Overlong
+// forms, surrogates and code points past U+10FFFF are malformed.
+static size_t json_utf8_sequence(const char *p, const char *end)
+{
+    unsigned char lead = *p;
+    unsigned char low = 0x80, high = 0xBF; // range of the second byte
+    ptrdiff_t size;
+    if (lead < 0x80)
+    {
+        return 1;
+    }
+    if (lead >= 0xC2 && lead <= 0xDF)
+    {
+        size = 2;
+    }
+    else if (lead >= 0xE0 && lead <= 0xEF)
+    {
+        size = 3;
+        low = lead == 0xE0 ? 0xA0 : 0x80;
+        high = lead == 0xED ? 0x9F : 0xBF;
+    }
+    else if (lead >= 0xF0 && lead <= 0xF4)
+    {
+        size = 4;
+        low = lead == 0xF0 ? 0x90 : 0x80;
+        high = lead == 0xF4 ? 0x8F : 0xBF;
+    }
+    else
+    {
+        return 0;
+    }
+    if (end - p < size || static_cast<unsigned char>(p[1]) < low || static_cast<unsigned char>(p[1]) > high)
+    {
+        return 0;
+    }
+    for (ptrdiff_t i = 2; i < size; i++)
+    {
+        if ((static_cast<unsigned char>(p[i]) & 0xC0) != 0x80)
+        {
+            return 0;
+        }
+    }
+    return size;
+}
+
+// First control character or first byte of a malformed UTF-8 sequence in
+// [p, end), or end. Printable ASCII runs are skipped a vector at a time.
+static const char *json_find_invalid_text(const char *p, const char *end)
+{
+    while ((p = json_skip_text(p, end)) < end)
+    {
+        size_t size = static_cast<unsigned char>(*p) < 0x20 ? 0 : json_utf8_sequence(p, end);
+        if (size == 0)
+        {
+            return p;
+        }
+        p += size;
+    }
+    return end;
+}
+
+static int json_hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool json_read_hex4(const char *p, const char *end, uint32_t& code)
+{
+    if (end - p < 4)
+    {
+        return false;
+    }
+    code = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        int digit = json_hex_digit(p[i]);
+        if (digit < 0)
+        {
+            return false;
+        }
+        code = code << 4 | static_cast<uint32_t>(digit);
+    }
+    return true;
+}
+
+static void json_append_utf8(JSON_String& out, uint32_t code)
+{
+    if (code < 0x80)
+    {
+        out.push_back(static_cast<char>(code));
+    }
+    else if (code < 0x800)
+    {
+        out.push_back(static_cast<char>(0xC0 | code >> 6));
+        out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+    else if (code < 0x10000)
+    {
+        out.push_back(static_cast<char>(0xE0 | code >> 12));
+        out.push_back(static_cast<char>(0x80 | (code >> 6 & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+    else
+    {
+        out.push_back(static_cast<char>(0xF0 | code >> 18));
+        out.push_back(static_cast<char>(0x80 | (code >> 12 & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (code >> 6 & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+}
+
+// Decodes the escape sequences of a raw string body into out. Returns false
+// on a malformed escape or an unpaired surrogate.
+static bool json_unescape(std::string_view raw, JSON_String& out)
+{
+    out.clear();
+    out.reserve(raw.size());
+    const char *p = raw.data();
+    const char *end = p + raw.size();
+    while (p < end)
+    {
+        const char *run = p;
+        while (p < end && *p != '\\')
+        {
+            p++;
+        }
+        out.append(run, p);
+        if (p == end)
+        {
+            break;
+        }
+        if (++p == end)
+        {
+            return false;
+        }
+        switch (*p++)
+        {
+            case '"':  out.push_back('"'); break;
+            case '\\': out.push_back('\\'); break;
+            case '/':  out.push_back('/'); break;
+            case 'b':  out.push_back('\b'); break;
+            case 'f':  out.push_back('\f'); break;
+            case 'n':  out.push_back('\n'); break;
+            case 'r':  out.push_back('\r'); break;
+            case 't':  out.push_back('\t'); break;
+            case 'u': {
+                uint32_t code;
+                if (!json_read_hex4(p, end, code))
+                {
+                    return false;
+                }
+                p += 4;
+                if (code >= 0xD800 && code <= 0xDBFF)
+                {
+                    uint32_t low;
+                    if (end - p < 6 || p[0] != '\\' || p[1] != 'u' || !json_read_hex4(p + 2, end, low) ||
+                        low < 0xDC00 || low > 0xDFFF)
+                    {
+                        return false;
+                    }
+                    p += 6;
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                else if (code >= 0xDC00 && code <= 0xDFFF)
+                {
+                    return false;
+                }
+                json_append_utf8(out, code);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+// Decimal exponent of the first significant digit of a valid number literal,
+// which tells an underflowing literal from an overflowing one. The exponent
+// is saturated far outside the range of a double.
+static long json_number_magnitude(const char *begin, const char *end)
+{
+    const char *p = begin + (*begin == '-');
+    long integer_digits = 0; // from the first significant one
+    long fraction_zeros = 0; // before the first significant digit
+    bool significant = false;
+    bool fraction = false;
+    for (; p < end && *p != 'e' && *p != 'E'; p++)
+    {
+        if (*p == '.')
+        {
+            fraction = true;
+        }
+        else if (!significant)
+        {
+            significant = *p != '0';
+            integer_digits += significant && !fraction;
+            fraction_zeros += fraction;
+        }
+        else
+        {
+            integer_digits += !fraction;
+        }
+    }
+    long exponent = 0;
+    if (p < end)
+    {
+        bool negative = *++p == '-';
+        p += *p == '+' || *p == '-';
+        for (; p < end; p++)
+        {
+            exponent = std::min(exponent * 10 + (*p - '0'), 1000000L);
+        }
+        exponent = negative ? -exponent : exponent;
+    }
+    return exponent + (integer_digits > 0 ? integer_digits - 1 : -fraction_zeros);
+}
+
+// Converts the number token [begin, end) into out. Integers are kept as
+// int64_t or uint64_t when they fit and fall back to double otherwise.
+// Returns an error message, or nullptr on success.
+static const char *json_parse_number(const char *begin, const char *end, JSON_Variant& out)
+{
+    // -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+    const char *p = begin;
+    auto digits = [&]() {
+        const char *from = p;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            p++;
+        }
+        return p - from;
+    };
+    if (p < end && *p == '-')
+    {
+        p++;
+    }
+    bool valid = p < end && (*p == '0' ? (p++, true) : digits() > 0);
+    bool integer = true;
+    if (valid && p < end && *p == '.')
+    {
+        p++;
+        integer = false;
+        valid = digits() > 0;
+    }
+    if (valid && p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        integer = false;
+        if (p < end && (*p == '+' || *p == '-'))
+        {
+            p++;
+        }
+        valid = digits() > 0;
+    }
+    if (!valid || p != end)
+    {
+        return "invalid literal";
+    }
+
+    if (integer)
+    {
+        int64_t small;
+        if (std::from_chars(begin, end, small).ec == std::errc())
+        {
+            out = small;
+            return nullptr;
+        }
+        uint64_t large;
+        if (*begin != '-' && std::from_chars(begin, end, large).ec == std::errc())
+        {
+            out = large;
+            return nullptr;
+        }
+    }
+
+    double number;
+    std::errc error = std::from_chars(begin, end, number).ec;
+    if (error == std::errc::result_out_of_range && json_number_magnitude(begin, end) < 0)
+    {
+        // Too small even for a denormal: rounds to zero of the literal's sign
+        number = *begin == '-' ? -0.0 : 0.0;
+    }
+    else if (error != std::errc())
+    {
+        return "number out of range";
+    }
+    out = number;
+    return nullptr;
+}
+
+JSON_Value JSON_Parser::parse(std::string_view input)
+{
+    return JSON_Parser::parse(input, std::pmr::get_default_resource());
+}
+
+JSON_Value JSON_Parser::parse(std::string_view input, std::pmr::memory_resource *resource)
+{
+    return JSON_Parser::parse(input, JSON_Parse_Options{}, resource);
+}
+
+// Finds the closing quote of a string body starting at p, or returns end if the
+// string continues past the buffer. escaped is set when a '\' is seen and
+// dangling when the buffer ends right after one.
+static const char *json_find_string_end(const char *p, const char *end, bool& escaped, bool& dangling)
+{
+    dangling = false;
+    while ((p = json_scan_string(p, end)) < end && *p == '\\')
+    {
+        escaped = true;
+        if (end - p < 2)
+        {
+            dangling = true;
+            return end;
+        }
+        p += 2;
+    }
+    return p;
+}
+
+static bool json_is_delimiter(char c)
+{
+    return json_is_space(c) || c == ',' || c == ']' || c == '}' || c == ':';
+}
+
+template <typename Handler>
+void JSON_Reader<Handler>::after_value()
+{
+    expect = scopes.empty() ? Expect::END : Expect::COMMA_OR_END;
+    empty = false;
+}
+
+// raw is the string body without quotes
+template <typename Handler>
+bool JSON_Reader<Handler>::on_string(std::string_view raw, bool escaped, bool in_input, size_t offset)
+{
+    {
+#if defined(JSON_STATS)
+        JSON_Stats_Timer timer(stats ? &stats->string_ticks : nullptr);
+#endif
+        // Escapes are printable ASCII, so checking the raw body covers the
+        // decoded string; control characters must be escaped
+        const char *invalid = json_find_invalid_text(raw.data(), raw.data() + raw.size());
+        if (invalid != raw.data() + raw.size())
+        {
+            throw JSON_Error(static_cast<unsigned char>(*invalid) < 0x20 ? "unescaped control character in string"
+                                                                         : "invalid UTF-8 in string",
+                             offset + (invalid - raw.data()));
+        }
+        if (escaped)
+        {
+            if (!json_unescape(raw, decoded))
+            {
+                throw JSON_Error("invalid escape sequence", offset);
+            }
+            raw = decoded;
+            in_input = false;
+        }
+    }
+
+    if (expect == Expect::KEY)
+    {
+        expect = Expect::COLON;
+        empty = false;
+        return deliver(JSON_Type::STRING, true, [&] { return handler.on_key(raw, in_input); });
+    }
+    after_value();
+    return deliver(JSON_Type::STRING, false, [&] { return handler.on_string(raw, in_input); });
+}
+
+template <typename Handler>
+bool JSON_Reader<Handler>::on_literal(std::string_view literal, size_t offset)
+{
+    after_value();
+    if (literal == "true" || literal == "false")
+    {
+        return deliver(JSON_Type::BOOLEAN, false, [&] { return handler.on_bool(literal == "true"); });
+    }
+    if (literal == "null")
+    {
+        return deliver(JSON_Type::NIL, false, [&] { return handler.on_null(); });
+    }
+
+    JSON_Variant number;
+    const char *error;
+    {
+#if defined(JSON_STATS)
+        JSON_Stats_Timer timer(stats ? &stats->number_ticks : nullptr);
+#endif
+        error = json_parse_number(literal.data(), literal.data() + literal.size(), number);
+    }
+    if (error)
+    {
+        throw JSON_Error(error, offset);
+    }
+    return deliver(JSON_Type::NUMBER, false, [&] {
+        if (const int64_t *integer = std::get_if<int64_t>(&number))
+        {
+            return handler.on_int64(*integer);
+        }
+        if (const uint64_t *integer = std::get_if<uint64_t>(&number))
+        {
+            return handler.on_uint64(*integer);
+        }
+        return handler.on_number(std::get<double>(number));
+    });
+}
+
+template <typename Handler>
+bool JSON_Reader<Handler>::feed(const char *data, size_t size)
+{
+    if (stopped)
+    {
+        return false;
+    }
+#if defined(JSON_STATS)
+    JSON_Stats_Timer timer(stats ? &stats->total_ticks : nullptr);
+    if (stats)
+    {
+        stats->bytes += size;
+    }
+#endif
+
+    const char *begin = data;
+    const char *end = begin + size;
+    const char *p = begin;
+
+    auto fail = [&](const char *what) {
+        throw JSON_Error(what, consumed + (p - begin));
+    };
+    auto stop = [&]() {
+        stopped = true;
+        consumed += p - begin;
+        return false;
+    };
+
+    if (size > max_size - consumed)
+    {
+        throw JSON_Error("document exceeds the size limit", max_size);
+    }
+
+    // Finish a token left over from the previous chunk
+    if (pending == Pending::STRING)
+    {
+        if (size == 0)
+        {
+            return true;
+        }
+        if (pending_dangling)
+        {
+            p++; // escaped by the '\' that ended the previous chunk
+        }
+        bool dangling;
+        p = json_find_string_end(p, end, pending_escaped, dangling);
+        if (p == end)
+        {
+            pending_dangling = dangling;
+            pending_token.append(begin, end);
+            consumed += size;
+            return true;
+        }
+        pending_token.append(begin, p++);
+        pending = Pending::NONE;
+        if (!on_string(pending_token, pending_escaped, false, pending_offset))
+        {
+            return stop();
+        }
+    }
+    else if (pending == Pending::LITERAL)
+    {
+        while (p < end && !json_is_delimiter(*p))
+        {
+            p++;
+        }
+        pending_token.append(begin, p);
+        if (p == end)
+        {
+            consumed += size;
+            return true;
+        }
+        pending = Pending::NONE;
+        if (!on_literal(pending_token, pending_offset))
+        {
+            return stop();
+        }
+    }
+
+    while (true)
+    {
+        while (p < end && json_is_space(*p))
+        {
+            p++;
+        }
+        if (p == end)
+        {
+            break;
+        }
+
+        bool ok = true;
+        switch (*p)
+        {
+            case '{':
+            case '[': {
+                if (expect != Expect::VALUE)
+                {
+                    fail("unexpected container");
+                }
+                if (scopes.size() == max_depth)
+                {
+                    fail("document nested too deeply");
+                }
+                bool is_object = *p == '{';
+                scopes.push_back(is_object);
+#if defined(JSON_STATS)
+                if (stats)
+                {
+                    stats->max_depth = std::max(stats->max_depth, scopes.size());
+                }
+#endif
+                expect = is_object ? Expect::KEY : Expect::VALUE;
+                empty = true;
+                p++;
+                ok = deliver(is_object ? JSON_Type::OBJECT : JSON_Type::ARRAY, false, [&] {
+                    return is_object ? handler.on_object_begin() : handler.on_array_begin();
+                });
+                break;
+            }
+            case '}':
+            case ']': {
+                bool is_object = *p == '}';
+                Expect opened = is_object ? Expect::KEY : Expect::VALUE;
+                if (scopes.empty() || scopes.back() != is_object ||
+                    !(expect == Expect::COMMA_OR_END || (expect == opened && empty)))
+                {
+                    fail("unexpected closing bracket");
+                }
+                scopes.pop_back();
+                after_value();
+                p++;
+                ok = deliver([&] { return is_object ? handler.on_object_end() : handler.on_array_end(); });
+                break;
+            }
+            case ',': {
+                if (expect != Expect::COMMA_OR_END)
+                {
+                    fail("unexpected ','");
+                }
+                expect = scopes.back() ? Expect::KEY : Expect::VALUE;
+                p++;
+                break;
+            }
+            case ':': {
+                if (expect != Expect::COLON)
+                {
+                    fail("unexpected ':'");
+                }
+                expect = Expect::VALUE;
+                p++;
+                break;
+            }
+            case '"': {
+                if (expect != Expect::KEY && expect != Expect::VALUE)
+                {
+                    fail("unexpected string");
+                }
+                const char *token = ++p;
+                bool escaped = false;
+                bool dangling;
+                p = json_find_string_end(p, end, escaped, dangling);
+                if (p == end)
+                {
+                    pending = Pending::STRING;
+                    pending_token.assign(token, end);
+                    pending_offset = consumed + (token - begin);
+                    pending_escaped = escaped;
+                    pending_dangling = dangling;
+                    break;
+                }
+                ok = on_string(std::string_view(token, p - token), escaped, true, consumed + (token - begin));
+                p++;
+                break;
+            }
+            default: {
+                if (expect != Expect::VALUE)
+                {
+                    fail("unexpected token");
+                }
+                const char *token = p;
+                while (p < end && !json_is_delimiter(*p))
+                {
+                    p++;
+                }
+                if (p == end)
+                {
+                    pending = Pending::LITERAL;
+                    pending_token.assign(token, end);
+                    pending_offset = consumed + (token - begin);
+                    break;
+                }
+                ok = on_literal(std::string_view(token, p - token), consumed + (token - begin));
+                break;
+            }
+        }
+        if (!ok)
+        {
+            return stop();
+        }
+    }
+
+    consumed += size;
+    return true;
+}
+
+template <typename Handler>
+bool JSON_Reader<Handler>::finish()
+{
+    if (stopped)
+    {
+        return false;
+    }
+#if defined(JSON_STATS)
+    JSON_Stats_Timer timer(stats ? &stats->total_ticks : nullptr);
+#endif
+    if (pending == Pending::LITERAL)
+    {
+        pending = Pending::NONE;
+        if (!on_literal(pending_token, pending_offset))
+        {
+            stopped = true;
+            return false;
+        }
+    }
+    if (pending == Pending::STRING)
+    {
+        throw JSON_Error("unterminated string", pending_offset);
+    }
+    if (expect != Expect::END)
+    {
+        throw JSON_Error("unexpected end of input", consumed);
+    }
+    return true;
+}
+
+template <typename Handler>
+void JSON_Reader<Handler>::reset()
+{
+    scopes.clear();
+    expect = Expect::VALUE;
+    empty = false;
+    stopped = false;
+    pending = Pending::NONE;
+    pending_token.clear();
+    pending_escaped = false;
+    pending_dangling = false;
+    consumed = 0;
+}
+
+// Values are moved into their slot as a variant so containers and strings keep
+// the allocator they were created with
+inline JSON_Value& JSON_DOM_Builder::place(JSON_Variant&& value)
+{
+    JSON_Value *slot = &root;
+    if (!stack.empty())
+    {
+        JSON_Value *top = stack.back();
+        slot = top->type() == JSON_Type::ARRAY ? &top->array().emplace_back() : member;
+    }
+    slot->value = std::move(value);
+    return *slot;
+}
+
+inline bool JSON_DOM_Builder::on_string(std::string_view str, bool in_input)
+{
+    if (options.borrow_strings && in_input)
+    {
+        place(str);
+    }
+    else
+    {
+        place(JSON_String(str, resource));
+    }
+    return true;
+}
+
+// The member is created as soon as its key is read, so the key never has to
+// be kept around; a duplicate key reuses the earlier member
+inline bool JSON_DOM_Builder::on_key(std::string_view key, bool in_input)
+{
+    JSON_Object& object = stack.back()->object();
+    if (options.keys)
+    {
+        member = &object.try_emplace(JSON_Key::borrow(options.keys->intern(key))).first->second;
+    }
+    else
+    {
+        member = options.borrow_strings && in_input ? &object.try_emplace(JSON_Key::borrow(key)).first->second
+                                                    : &object[key];
+    }
+    return true;
+}
+
+inline bool JSON_DOM_Builder::on_object_begin()
+{
+    stack.push_back(&place(JSON_Object(resource)));
+    return true;
+}
+
+inline bool JSON_DOM_Builder::on_object_end()
+{
+    stack.pop_back();
+    return true;
+}
+
+inline bool JSON_DOM_Builder::on_array_begin()
+{
+    stack.push_back(&place(JSON_Array(resource)));
+    return true;
+}
+
+inline bool JSON_DOM_Builder::on_array_end()
+{
+    stack.pop_back();
+    return true;
+}
+
+inline void JSON_DOM_Builder::reserve(size_t size)
+{
+    JSON_Value *top = stack.back();
+    if (top->type() == JSON_Type::ARRAY)
+    {
+        top->array().reserve(size);
+    }
+    else
+    {
+        top->object().reserve(size);
+    }
+}
+
+inline JSON_Value JSON_DOM_Builder::release()
+{
+    JSON_Value document = std::move(root);
+    root = JSON_Value();
+    stack.clear();
+    member = nullptr;
+    return document;
+}
+
+inline JSON_Value JSON_Push_Parser::finish()
+{
+    reader.finish();
+    reader.reset();
+    return builder.release();
+}
+
+inline void JSON_Push_Parser::reset()
+{
+    reader.reset();
+    builder.release();
+}
+
+// The arena parser's builder keeps a pointer to the arena, which stays at the
+// same address when recycle() rebuilds it
+inline JSON_Reusable_Parser::JSON_Reusable_Parser(const JSON_Parse_Options& options,
+                                                  std::pmr::memory_resource *resource)
+    : arena(std::in_place, &overflow), heap(options, resource), in_arena(options, &*arena)
+{
+    new (&tree) JSON_Value();
+}
+
+inline JSON_Value JSON_Reusable_Parser::run(JSON_Push_Parser& parser, std::string_view input)
+{
+    try
+    {
+        parser.feed(input);
+        return parser.finish();
+    }
+    catch (...)
+    {
+        parser.reset();
+        throw;
+    }
+}
+
+inline JSON_Value JSON_Reusable_Parser::parse(std::string_view input)
+{
+    return run(heap, input);
+}
+
+inline const JSON_Value& JSON_Reusable_Parser::parse_in_arena(std::string_view input)
+{
+    recycle();
+    JSON_Value parsed = run(in_arena, input);
+    tree.value = std::move(parsed.value);
+    return tree;
+}
+
+inline void JSON_Reusable_Parser::reset()
+{
+    heap.reset();
+    in_arena.reset();
+    recycle();
+}
+
+inline void JSON_Reusable_Parser::recycle()
+{
+    new (&tree) JSON_Value();
+    arena.reset();
+    if (overflow.used > 0)
+    {
+        capacity += overflow.used;
+        buffer.reset(new std::byte[capacity]);
+        overflow.used = 0;
+    }
+    if (capacity > 0)
+    {
+        arena.emplace(buffer.get(), capacity, &overflow);
+    }
+    else
+    {
+        arena.emplace(&overflow);
+    }
+}
+
+#if defined(JSON_STATS)
+inline JSON_Value JSON_Parse_Stats::to_value() const
+{
+    static const char *const names[] = {"booleans", "numbers", "strings", "arrays", "objects", "nulls"};
+    JSON_Value stats = JSON_Object();
+    stats.emplace("bytes", static_cast<uint64_t>(bytes));
+    for (size_t i = 0; i < std::size(names); i++)
+    {
+        stats.emplace(names[i], static_cast<uint64_t>(values[i]));
+    }
+    stats.emplace("keys", static_cast<uint64_t>(keys));
+    stats.emplace("max_depth", static_cast<uint64_t>(max_depth));
+    stats.emplace("allocations", static_cast<uint64_t>(allocations));
+    stats.emplace("allocated_bytes", static_cast<uint64_t>(allocated_bytes));
+    stats.emplace("total_ticks", total_ticks);
+    stats.emplace("number_ticks", number_ticks);
+    stats.emplace("string_ticks", string_ticks);
+    stats.emplace("handler_ticks", handler_ticks);
+    return stats;
+}
+#endif
+
+JSON_Value JSON_Parser::parse(std::string_view input, const JSON_Parse_Options& options,
+                              std::pmr::memory_resource *resource)
+{
+    JSON_Push_Parser parser(options, resource);
+    parser.feed(input);
+    return parser.finish();
+}
+
+template <typename Handler>
+bool JSON_Parser::read(std::string_view input, Handler& handler, const JSON_Parse_Options& options)
+{
+    JSON_Reader<Handler> reader(handler, options);
+    return reader.feed(input) && reader.finish();
+}
+
+// Position just past the first line break at or after from
+static size_t json_line_boundary(std::string_view input, size_t from)
+{
+    if (from >= input.size())
+    {
+        return input.size();
+    }
+    const void *newline = std::memchr(input.data() + from, '\n', input.size() - from);
+    return newline ? static_cast<const char*>(newline) - input.data() + 1 : input.size();
+}
+
+// Parses every line of piece, which starts at byte base of the whole input
+static void json_parse_line_piece(std::string_view piece, size_t base, const JSON_Parse_Options& options,
+                                  std::vector<JSON_Value>& out)
+{
+    JSON_Push_Parser parser(options);
+    size_t line = 0;
+    while (line < piece.size())
+    {
+        size_t next = json_line_boundary(piece, line);
+        std::string_view text = piece.substr(line, next - line);
+        if (std::any_of(text.begin(), text.end(), [](char c) { return !json_is_space(c); }))
+        {
+            try
+            {
+                parser.feed(text);
+                out.push_back(parser.finish());
+            }
+            catch (const JSON_Error& error)
+            {
+                throw JSON_Error(error.what(), base + line + error.offset);
+            }
+        }
+        line = next;
+    }
+}
+
+template <typename Callback>
+void JSON_Parser::stream_lines(std::string_view input, Callback&& callback, unsigned threads,
+                               const JSON_Parse_Options& options)
+{
+    // The input is cut into pieces of about this size, ending at line ends
+    constexpr size_t piece_size = 1 << 20;
+
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // A key table is not synchronized, nor are stats
+    if (options.keys)
+    {
+        threads = 1;
+    }
+#if defined(JSON_STATS)
+    if (options.stats)
+    {
+        threads = 1;
+    }
+#endif
+    // Piece i starts at the first line that starts past i * piece_size, so
+    // every piece can be found without the ones before it
+    size_t count = (input.size() + piece_size - 1) / piece_size;
+    auto parse_piece = [&](size_t i, std::vector<JSON_Value>& out) {
+        size_t begin = i == 0 ? 0 : json_line_boundary(input, i * piece_size);
+        size_t end = json_line_boundary(input, (i + 1) * piece_size);
+        json_parse_line_piece(input.substr(begin, end - begin), begin, options, out);
+    };
+    if (threads == 1 || count <= 1)
+    {
+        std::vector<JSON_Value> values;
+        for (size_t i = 0; i < count; i++)
+        {
+            parse_piece(i, values);
+            for (JSON_Value& value : values)
+            {
+                callback(std::move(value));
+            }
+            values.clear();
+        }
+        return;
+    }
+    threads = static_cast<unsigned>(std::min<size_t>(threads, count));
+
+    // The workers live for the whole call and take pieces in input order.
+    // Finished pieces wait in a window of slots until the calling thread
+    // hands them to callback in order; a piece is only taken while its slot
+    // is free, which bounds how far the workers run ahead.
+    struct Slot
+    {
+        std::vector<JSON_Value> values;
+        std::exception_ptr error;
+        bool ready = false;
+    };
+    std::vector<Slot> window(threads * 2);
+    std::mutex mutex;
+    std::condition_variable filled;  // a slot became ready
+    std::condition_variable drained; // a slot became free, or the workers must stop
+    size_t next = 0;                 // next piece to take
+    size_t delivered = 0;            // pieces taken out of the window
+    bool stop = false;
+
+    auto work = [&] {
+        for (;;)
+        {
+            size_t i;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                drained.wait(lock, [&] { return stop || next >= count || next < delivered + window.size(); });
+                if (stop || next >= count)
+                {
+                    return;
+                }
+                i = next++;
+            }
+            Slot result;
+            try
+            {
+                parse_piece(i, result.values);
+            }
+            catch (...)
+            {
+                result.error = std::current_exception();
+            }
+            result.ready = true;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                window[i % window.size()] = std::move(result);
+            }
+            filled.notify_one();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    auto join = [&] {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        drained.notify_all();
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+    };
+    try
+    {
+        for (unsigned i = 0; i < threads; i++)
+        {
+            workers.emplace_back(work);
+        }
+        while (delivered < count)
+        {
+            Slot piece;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                Slot& slot = window[delivered % window.size()];
+                filled.wait(lock, [&] { return slot.ready; });
+                piece = std::move(slot);
+                slot = Slot();
+                delivered++;
+            }
+            drained.notify_all();
+            if (piece.error)
+            {
+                std::rethrow_exception(piece.error);
+            }
+            for (JSON_Value& value : piece.values)
+            {
+                callback(std::move(value));
+            }
+        }
+    }
+    catch (...)
+    {
+        join();
+        throw;
+    }
+    join();
+}
+
+inline std::vector<JSON_Value> JSON_Parser::parse_lines(std::string_view input, unsigned threads,
+                                                         const JSON_Parse_Options& options)
+{
+    std::vector<JSON_Value> values;
+    JSON_Parser::stream_lines(input, [&](JSON_Value&& value) { values.push_back(std::move(value)); },
+                              threads, options);
+    return values;
+}
+
+#if defined(JSON_HAS_MMAP)
+inline JSON_Mapped_File::JSON_Mapped_File(const char *path)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0)
+    {
+        int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), path);
+    }
+    size = static_cast<size_t>(info.st_size);
+    // Empty files cannot be mapped; they are simply empty input
+    if (size > 0)
+    {
+        void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), path);
+        }
+        ::madvise(mapping, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(mapping);
+    }
+    ::close(fd);
+}
+
+inline JSON_Mapped_File::~JSON_Mapped_File()
+{
+    if (data)
+    {
+        ::munmap(const_cast<char*>(data), size);
+    }
+}
+#else
+inline JSON_Mapped_File::JSON_Mapped_File(const char *path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw std::system_error(std::make_error_code(std::errc::no_such_file_or_directory), path);
+    }
+    contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    data = contents.data();
+    size = contents.size();
+}
+
+inline JSON_Mapped_File::~JSON_Mapped_File() {}
+#endif
+
+JSON_Value JSON_Parser::parse_file(const char *path, std::pmr::memory_resource *resource)
+{
+    JSON_Mapped_File file(path);
+    return JSON_Parser::parse(file.view(), resource);
+}
+
+JSON_Value JSON_Parser::parse(const char *data, size_t size)
+{
+    return JSON_Parser::parse(std::string_view(data, size));
+}
+
+JSON_Value JSON_Parser::parse(std::istringstream&& isstream)
+{
+    std::string buffer{std::istreambuf_iterator<char>(isstream), std::istreambuf_iterator<char>()};
+    return JSON_Parser::parse(std::string_view(buffer));
+}
+
+JSON_Value JSON_Parser::parse(const std::string& str)
+{
+    return JSON_Parser::parse(std::string_view(str));
+}
+
+JSON_Value JSON_Parser::parse(const char *c_str)
+{
+    return JSON_Parser::parse(std::string_view(c_str));
+}
+ 
+// Compact read-only node: 16 bytes for every value. Scalars and strings of up
+// to 14 bytes are stored inline; longer strings, arrays and objects point to
+// exactly sized blocks in the arena of their JSON_Compact_Document. Nodes are
+// trivially copyable and never own memory.
+struct JSON_Compact_Member;
+struct JSON_Compact_Value
+{
+    static constexpr size_t inline_capacity = 14;
+
+    JSON_Compact_Value()
+    {
+        bytes[tag_byte] = NIL_TAG;
+    }
+
+    explicit JSON_Compact_Value(bool boolean) : JSON_Compact_Value()
+    {
+        store(boolean, BOOLEAN_TAG);
+    }
+
+    explicit JSON_Compact_Value(double number) : JSON_Compact_Value()
+    {
+        store(number, DOUBLE_TAG);
+    }
+
+    explicit JSON_Compact_Value(int64_t number) : JSON_Compact_Value()
+    {
+        store(number, INT64_TAG);
+    }
+
+    explicit JSON_Compact_Value(uint64_t number) : JSON_Compact_Value()
+    {
+        store(number, UINT64_TAG);
+    }
+
+    // Long strings are copied into arena
+    static JSON_Compact_Value make_string(std::string_view str, std::pmr::memory_resource *arena);
+    static JSON_Compact_Value make_array(std::span<const JSON_Compact_Value> elements,
+                                         std::pmr::memory_resource *arena);
+    // keys_and_values alternates each key (a string node) with its value
+    static JSON_Compact_Value make_object(std::span<const JSON_Compact_Value> keys_and_values,
+                                          std::pmr::memory_resource *arena);
+
+    JSON_Type type() const;
+
+    bool is_null() const
+    {
+        return tag() == NIL_TAG;
+    }
+
+    bool boolean() const
+    {
+        assert(tag() == BOOLEAN_TAG);
+        return load<bool>();
+    }
+
+    double number() const;
+
+    bool is_int64() const
+    {
+        return tag() == INT64_TAG || (tag() == UINT64_TAG && load<uint64_t>() <= INT64_MAX);
+    }
+
+    int64_t int64() const
+    {
+        assert(is_int64());
+        return load<int64_t>();
+    }
+
+    bool is_uint64() const
+    {
+        return tag() == UINT64_TAG || (tag() == INT64_TAG && load<int64_t>() >= 0);
+    }
+
+    uint64_t uint64() const
+    {
+        assert(is_uint64());
+        return load<uint64_t>();
+    }
+
+    std::string_view string_view() const;
+
+    std::string string() const
+    {
+        return std::string(string_view());
+    }
+
+    // Number of elements or members
+    size_t size() const
+    {
+        assert(tag() == ARRAY_TAG || tag() == OBJECT_TAG);
+        return count();
+    }
+
+    std::span<const JSON_Compact_Value> array() const
+    {
+        assert(tag() == ARRAY_TAG);
+        return {load<const JSON_Compact_Value*>(), count()};
+    }
+
+    std::span<const JSON_Compact_Member> object() const;
+
+    // Throws std::out_of_range like the const JSON_Value accessors
+    const JSON_Compact_Value& operator[](std::string_view key) const;
+    const JSON_Compact_Value& operator[](size_t index) const;
+
+    // Member lookup; nullptr when key is missing
+    const JSON_Compact_Value *find(std::string_view key) const;
+
+    JSON_Value to_value() const;
+
+private:
+    enum : uint8_t { NIL_TAG, BOOLEAN_TAG, DOUBLE_TAG, INT64_TAG, UINT64_TAG, SHORT_STRING_TAG, STRING_TAG,
+                     ARRAY_TAG, OBJECT_TAG };
+
+    // Bytes 0-7 hold the payload, 8-11 the length of out-of-line data and 15
+    // the tag. Short strings use bytes 0-13 for characters and 14 for length.
+    static constexpr size_t count_byte = 8;
+    static constexpr size_t short_size_byte = 14;
+    static constexpr size_t tag_byte = 15;
+
+    uint8_t tag() const
+    {
+        return bytes[tag_byte];
+    }
+
+    template <typename T>
+    T load() const
+    {
+        T payload;
+        std::memcpy(&payload, bytes, sizeof(T));
+        return payload;
+    }
+
+    template <typename T>
+    void store(T payload, uint8_t tag)
+    {
+        std::memcpy(bytes, &payload, sizeof(T));
+        bytes[tag_byte] = tag;
+    }
+
+    uint32_t count() const
+    {
+        uint32_t size;
+        std::memcpy(&size, bytes + count_byte, sizeof(size));
+        return size;
+    }
+
+    template <typename T>
+    static JSON_Compact_Value make_block(const void *data, size_t size, uint8_t tag, std::pmr::memory_resource *arena);
+
+    alignas(8) unsigned char bytes[16];
+};
+
+static_assert(sizeof(JSON_Compact_Value) == 16);
+
+struct JSON_Compact_Member
+{
+    JSON_Compact_Value key;
+    JSON_Compact_Value value;
+};
+
+template <typename T>
+JSON_Compact_Value JSON_Compact_Value::make_block(const void *data, size_t size, uint8_t tag,
+                                                  std::pmr::memory_resource *arena)
+{
+    assert(size <= UINT32_MAX);
+    JSON_Compact_Value node;
+    T *block = nullptr;
+    if (size > 0)
+    {
+        block = static_cast<T*>(arena->allocate(size * sizeof(T), alignof(T)));
+        std::memcpy(static_cast<void*>(block), data, size * sizeof(T));
+    }
+    node.store(static_cast<const T*>(block), tag);
+    uint32_t count = static_cast<uint32_t>(size);
+    std::memcpy(node.bytes + count_byte, &count, sizeof(count));
+    return node;
+}
+
+inline JSON_Compact_Value JSON_Compact_Value::make_string(std::string_view str, std::pmr::memory_resource *arena)
+{
+    if (str.size() > inline_capacity)
+    {
+        return make_block<char>(str.data(), str.size(), STRING_TAG, arena);
+    }
+    JSON_Compact_Value node;
+    std::memcpy(node.bytes, str.data(), str.size());
+    node.bytes[short_size_byte] = static_cast<unsigned char>(str.size());
+    node.bytes[tag_byte] = SHORT_STRING_TAG;
+    return node;
+}
+
+inline JSON_Compact_Value JSON_Compact_Value::make_array(std::span<const JSON_Compact_Value> elements,
+                                                         std::pmr::memory_resource *arena)
+{
+    return make_block<JSON_Compact_Value>(elements.data(), elements.size(), ARRAY_TAG, arena);
+}
+
+inline JSON_Compact_Value JSON_Compact_Value::make_object(std::span<const JSON_Compact_Value> keys_and_values,
+                                                          std::pmr::memory_resource *arena)
+{
+    assert(keys_and_values.size() % 2 == 0);
+    static_assert(sizeof(JSON_Compact_Member) == 2 * sizeof(JSON_Compact_Value));
+    // A member is laid out exactly like a key node followed by a value node
+    return make_block<JSON_Compact_Member>(keys_and_values.data(), keys_and_values.size() / 2, OBJECT_TAG, arena);
+}
+
+inline JSON_Type JSON_Compact_Value::type() const
+{
+    switch (tag())
+    {
+        case BOOLEAN_TAG:
+            return JSON_Type::BOOLEAN;
+        case DOUBLE_TAG:
+        case INT64_TAG:
+        case UINT64_TAG:
+            return JSON_Type::NUMBER;
+        case SHORT_STRING_TAG:
+        case STRING_TAG:
+            return JSON_Type::STRING;
+        case ARRAY_TAG:
+            return JSON_Type::ARRAY;
+        case OBJECT_TAG:
+            return JSON_Type::OBJECT;
+        default:
+            return JSON_Type::NIL;
+    }
+}
+
+inline double JSON_Compact_Value::number() const
+{
+    switch (tag())
+    {
+        case INT64_TAG:
+            return static_cast<double>(load<int64_t>());
+        case UINT64_TAG:
+            return static_cast<double>(load<uint64_t>());
+        default:
+            assert(tag() == DOUBLE_TAG);
+            return load<double>();
+    }
+}
+
+inline std::string_view JSON_Compact_Value::string_view() const
+{
+    if (tag() == SHORT_STRING_TAG)
+    {
+        return {reinterpret_cast<const char*>(bytes), bytes[short_size_byte]};
+    }
+    assert(tag() == STRING_TAG);
+    return {load<const char*>(), count()};
+}
+
+inline std::span<const JSON_Compact_Member> JSON_Compact_Value::object() const
+{
+    assert(tag() == OBJECT_TAG);
+    return {load<const JSON_Compact_Member*>(), count()};
+}
+
+inline const JSON_Compact_Value *JSON_Compact_Value::find(std::string_view key) const
+{
+    for (const JSON_Compact_Member& member : object())
+    {
+        if (member.key.string_view() == key)
+        {
+            return &member.value;
+        }
+    }
+    return nullptr;
+}
+
+inline const JSON_Compact_Value& JSON_Compact_Value::operator[](std::string_view key) const
+{
+    const JSON_Compact_Value *value = find(key);
+    if (!value)
+    {
+        throw std::out_of_range("JSON_Compact_Value::operator[]");
+    }
+    return *value;
+}
+
+inline const JSON_Compact_Value& JSON_Compact_Value::operator[](size_t index) const
+{
+    std::span<const JSON_Compact_Value> elements = array();
+    if (index >= elements.size())
+    {
+        throw std::out_of_range("JSON_Compact_Value::operator[]");
+    }
+    return elements[index];
+}
+
+inline JSON_Value JSON_Compact_Value::to_value() const
+{
+    switch (tag())
+    {
+        case BOOLEAN_TAG:
+            return JSON_Value(boolean());
+        case DOUBLE_TAG:
+            return JSON_Value(load<double>());
+        case INT64_TAG:
+            return JSON_Value(load<int64_t>());
+        case UINT64_TAG:
+            return JSON_Value(load<uint64_t>());
+        case SHORT_STRING_TAG:
+        case STRING_TAG:
+            return JSON_Value(JSON_String(string_view()));
+        case ARRAY_TAG: {
+            JSON_Array elements;
+            elements.reserve(count());
+            for (const JSON_Compact_Value& element : array())
+            {
+                elements.push_back(element.to_value());
+            }
+            return JSON_Value(std::move(elements));
+        }
+        case OBJECT_TAG: {
+            JSON_Object members;
+            members.reserve(count());
+            for (const JSON_Compact_Member& member : object())
+            {
+                members.insert_or_assign(member.key.string_view(), member.value.to_value());
+            }
+            return JSON_Value(std::move(members));
+        }
+        default:
+            return JSON_Value();
+    }
+}
+
+// Builds compact nodes from reader events. Finished children wait on a scratch
+// stack until their container closes, so every array and object is copied
+// into the arena once, at its final size.
+struct JSON_Compact_Builder : JSON_Handler
+{
+    explicit JSON_Compact_Builder(std::pmr::memory_resource *arena) : arena(arena) {}
+
+    bool on_null() { nodes.emplace_back(); return true; }
+    bool on_bool(bool boolean) { nodes.emplace_back(boolean); return true; }
+    bool on_number(double number) { nodes.emplace_back(number); return true; }
+    bool on_int64(int64_t number) { nodes.emplace_back(number); return true; }
+    bool on_uint64(uint64_t number) { nodes.emplace_back(number); return true; }
+
+    bool on_string(std::string_view str, bool)
+    {
+        nodes.push_back(JSON_Compact_Value::make_string(str, arena));
+        return true;
+    }
+
+    bool on_key(std::string_view key, bool)
+    {
+        nodes.push_back(JSON_Compact_Value::make_string(key, arena));
+        return true;
+    }
+
+    bool on_object_begin() { scopes.push_back(nodes.size()); return true; }
+    bool on_array_begin() { scopes.push_back(nodes.size()); return true; }
+
+    bool on_object_end()
+    {
+        close(JSON_Compact_Value::make_object);
+        return true;
+    }
+
+    bool on_array_end()
+    {
+        close(JSON_Compact_Value::make_array);
+        return true;
+    }
+
+    JSON_Compact_Value release()
+    {
+        assert(nodes.size() == 1 && scopes.empty());
+        JSON_Compact_Value root = nodes.back();
+        nodes.clear();
+        return root;
+    }
+
+private:
+    template <typename Make>
+    void close(Make make)
+    {
+        size_t first = scopes.back();
+        scopes.pop_back();
+        std::span<const JSON_Compact_Value> children(nodes.data() + first, nodes.size() - first);
+        JSON_Compact_Value container = make(children, arena);
+        nodes.resize(first);
+        nodes.push_back(container);
+    }
+
+    std::pmr::memory_resource *arena;
+    std::vector<JSON_Compact_Value> nodes;
+    std::vector<size_t> scopes;
+};
+
+// Owns a tree of compact nodes and the arena they live in
+struct JSON_Compact_Document
+{
+    JSON_Compact_Document() = default;
+
+    explicit JSON_Compact_Document(std::string_view input)
+    {
+        parse(input);
+    }
+
+    JSON_Compact_Document(const JSON_Compact_Document&) = delete;
+    JSON_Compact_Document& operator=(const JSON_Compact_Document&) = delete;
+
+    void parse(std::string_view input)
+    {
+        build([&](JSON_Compact_Builder& builder) { JSON_Parser::read(input, builder); });
+    }
+
+    void assign(const JSON_Value& value)
+    {
+        build([&](JSON_Compact_Builder& builder) { value.emit(builder); });
+    }
+
+    const JSON_Compact_Value& root() const
+    {
+        return tree;
+    }
+
+    // Bytes taken from the arena so far
+    size_t arena_size() const
+    {
+        return used;
+    }
+
+private:
+    // Counts what the nodes take out of the monotonic arena
+    struct Counting_Resource : std::pmr::memory_resource
+    {
+        explicit Counting_Resource(std::pmr::memory_resource *upstream, size_t& used) : upstream(upstream), used(used) {}
+
+        void *do_allocate(size_t bytes, size_t alignment) override
+        {
+            used += bytes;
+            return upstream->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void *, size_t, size_t) override {}
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+        {
+            return this == &other;
+        }
+
+        std::pmr::memory_resource *upstream;
+        size_t& used;
+    };
+
+    template <typename Fill>
+    void build(Fill fill)
+    {
+        tree = JSON_Compact_Value();
+        arena.release();
+        used = 0;
+        JSON_Compact_Builder builder(&counter);
+        fill(builder);
+        tree = builder.release();
+    }
+
+    std::pmr::monotonic_buffer_resource arena;
+    size_t used = 0;
+    Counting_Resource counter{&arena, used};
+    JSON_Compact_Value tree;
+};
+
+// Flat immutable document: one array of 64-bit tagged entries plus one buffer
+// of string bytes. The top byte of an entry is its tag and the low 56 bits its
+// payload:
+//   'n' 't' 'f'  null, true, false
+//   'd' 'l' 'u'  double, int64_t, uint64_t; the value is in the next entry
+//   '"'          offset of a 4-byte length and the characters in strings
+//   '[' '{'      low 32 bits: index just past the matching close; bits
+//                32-55: element or member count, saturated
+//   ']' '}'      index of the matching open
+// Objects hold a key string entry before each value. Skipping a subtree is a
+// single jump, and reading never allocates.
+struct JSON_Tape_Ref;
+struct JSON_Tape
+{
+    JSON_Tape() = default;
+
+    explicit JSON_Tape(std::string_view input)
+    {
+        parse(input);
+    }
+
+    void parse(std::string_view input);
+    void assign(const JSON_Value& value);
+
+    JSON_Tape_Ref root() const;
+
+    std::vector<uint64_t> entries;
+    std::string strings;
+};
+
+// Cursor into a JSON_Tape with the reading half of the JSON_Value interface.
+// Stays valid as long as the tape's buffers do.
+struct JSON_Tape_Ref
+{
+    struct Array;
+    struct Object;
+
+    JSON_Tape_Ref(const JSON_Tape& tape, size_t index)
+        : entries(tape.entries.data()), strings(tape.strings.data()), index(index) {}
+
+    JSON_Type type() const;
+
+    bool is_null() const
+    {
+        return tag() == 'n';
+    }
+
+    bool boolean() const
+    {
+        assert(tag() == 't' || tag() == 'f');
+        return tag() == 't';
+    }
+
+    double number() const;
+
+    bool is_int64() const
+    {
+        return tag() == 'l' || (tag() == 'u' && entries[index + 1] <= INT64_MAX);
+    }
+
+    int64_t int64() const
+    {
+        assert(is_int64());
+        return static_cast<int64_t>(entries[index + 1]);
+    }
+
+    bool is_uint64() const
+    {
+        return tag() == 'u' || (tag() == 'l' && static_cast<int64_t>(entries[index + 1]) >= 0);
+    }
+
+    uint64_t uint64() const
+    {
+        assert(is_uint64());
+        return entries[index + 1];
+    }
+
+    std::string_view string_view() const;
+
+    std::string string() const
+    {
+        return std::string(string_view());
+    }
+
+    // Number of elements or members; counts past 2^24 - 1 are walked
+    size_t size() const;
+
+    Array array() const;
+    Object object() const;
+
+    // Throws std::out_of_range like the const JSON_Value accessors
+    JSON_Tape_Ref operator[](std::string_view key) const;
+    JSON_Tape_Ref operator[](size_t index) const;
+
+    // Member lookup; false when key is missing
+    bool find(std::string_view key, JSON_Tape_Ref& value) const;
+
+    JSON_Value to_value() const;
+
+    // Index of the entry after this value and its whole subtree
+    size_t next() const;
+
+    size_t position() const
+    {
+        return index;
+    }
+
+private:
+    JSON_Tape_Ref(const uint64_t *entries, const char *strings, size_t index)
+        : entries(entries), strings(strings), index(index) {}
+
+    char tag() const
+    {
+        return static_cast<char>(entries[index] >> 56);
+    }
+
+    uint64_t payload() const
+    {
+        return entries[index] & ((uint64_t(1) << 56) - 1);
+    }
+
+    JSON_Tape_Ref at(size_t position) const
+    {
+        return {entries, strings, position};
+    }
+
+    const uint64_t *entries;
+    const char *strings;
+    size_t index;
+};
+
+struct JSON_Tape_Ref::Array
+{
+    struct iterator
+    {
+        JSON_Tape_Ref current;
+
+        JSON_Tape_Ref operator*() const { return current; }
+        iterator& operator++() { current = current.at(current.next()); return *this; }
+        bool operator!=(const iterator& other) const { return current.index != other.current.index; }
+    };
+
+    iterator begin() const { return {container.at(container.index + 1)}; }
+    iterator end() const { return {container.at(container.next() - 1)}; }
+
+    JSON_Tape_Ref container;
+};
+
+struct JSON_Tape_Ref::Object
+{
+    struct iterator
+    {
+        JSON_Tape_Ref current; // at the key
+
+        std::pair<std::string_view, JSON_Tape_Ref> operator*() const
+        {
+            return {current.string_view(), current.at(current.index + 1)};
+        }
+        iterator& operator++() { current = current.at(current.at(current.index + 1).next()); return *this; }
+        bool operator!=(const iterator& other) const { return current.index != other.current.index; }
+    };
+
+    iterator begin() const { return {container.at(container.index + 1)}; }
+    iterator end() const { return {container.at(container.next() - 1)}; }
+
+    JSON_Tape_Ref container;
+};
+
+inline JSON_Type JSON_Tape_Ref::type() const
+{
+    switch (tag())
+    {
+        case 't':
+        case 'f':
+            return JSON_Type::BOOLEAN;
+        case 'd':
+        case 'l':
+        case 'u':
+            return JSON_Type::NUMBER;
+        case '"':
+            return JSON_Type::STRING;
+        case '[':
+            return JSON_Type::ARRAY;
+        case '{':
+            return JSON_Type::OBJECT;
+        default:
+            return JSON_Type::NIL;
+    }
+}
+
+inline double JSON_Tape_Ref::number() const
+{
+    uint64_t bits = entries[index + 1];
+    switch (tag())
+    {
+        case 'l':
+            return static_cast<double>(static_cast<int64_t>(bits));
+        case 'u':
+            return static_cast<double>(bits);
+        default:
+            assert(tag() == 'd');
+            return std::bit_cast<double>(bits);
+    }
+}
+
+inline std::string_view JSON_Tape_Ref::string_view() const
+{
+    assert(tag() == '"');
+    const char *str = strings + payload();
+    uint32_t size;
+    std::memcpy(&size, str, sizeof(size));
+    return {str + sizeof(size), size};
+}
+
+inline size_t JSON_Tape_Ref::next() const
+{
+    switch (tag())
+    {
+        case '[':
+        case '{':
+            return static_cast<uint32_t>(payload());
+        case 'd':
+        case 'l':
+        case 'u':
+            return index + 2;
+        default:
+            return index + 1;
+    }
+}
+
+inline size_t JSON_Tape_Ref::size() const
+{
+    assert(tag() == '[' || tag() == '{');
+    size_t count = payload() >> 32;
+    if (count < 0xFFFFFF)
+    {
+        return count;
+    }
+    count = 0;
+    size_t step = tag() == '{' ? 2 : 1; // a key entry precedes every member
+    for (size_t i = index + 1; i + 1 < next(); i = at(i + step - 1).next())
+    {
+        count++;
+    }
+    return count;
+}
+
+inline JSON_Tape_Ref::Array JSON_Tape_Ref::array() const
+{
+    assert(tag() == '[');
+    return {*this};
+}
+
+inline JSON_Tape_Ref::Object JSON_Tape_Ref::object() const
+{
+    assert(tag() == '{');
+    return {*this};
+}
+
+inline bool JSON_Tape_Ref::find(std::string_view key, JSON_Tape_Ref& value) const
+{
+    for (auto [name, member] : object())
+    {
+        if (name == key)
+        {
+            value = member;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline JSON_Tape_Ref JSON_Tape_Ref::operator[](std::string_view key) const
+{
+    JSON_Tape_Ref value = *this;
+    if (!find(key, value))
+    {
+        throw std::out_of_range("JSON_Tape_Ref::operator[]");
+    }
+    return value;
+}
+
+inline JSON_Tape_Ref JSON_Tape_Ref::operator[](size_t position) const
+{
+    for (JSON_Tape_Ref element : array())
+    {
+        if (position-- == 0)
+        {
+            return element;
+        }
+    }
+    throw std::out_of_range("JSON_Tape_Ref::operator[]");
+}
+
+inline JSON_Value JSON_Tape_Ref::to_value() const
+{
+    switch (tag())
+    {
+        case 't':
+        case 'f':
+            return JSON_Value(boolean());
+        case 'd':
+            return JSON_Value(number());
+        case 'l':
+            return JSON_Value(int64());
+        case 'u':
+            return JSON_Value(uint64());
+        case '"':
+            return JSON_Value(JSON_String(string_view()));
+        case '[': {
+            JSON_Array elements;
+            elements.reserve(size());
+            for (JSON_Tape_Ref element : array())
+            {
+                elements.push_back(element.to_value());
+            }
+            return JSON_Value(std::move(elements));
+        }
+        case '{': {
+            JSON_Object members;
+            members.reserve(size());
+            for (auto [key, member] : object())
+            {
+                members.insert_or_assign(key, member.to_value());
+            }
+            return JSON_Value(std::move(members));
+        }
+        default:
+            return JSON_Value();
+    }
+}
+
+// Appends reader events to a tape; a scope's open entry is patched once its
+// close is known
+struct JSON_Tape_Builder : JSON_Handler
+{
+    explicit JSON_Tape_Builder(JSON_Tape& tape) : tape(tape) {}
+
+    bool on_null() { append('n', 0); return true; }
+    bool on_bool(bool boolean) { append(boolean ? 't' : 'f', 0); return true; }
+
+    bool on_number(double number)
+    {
+        append('d', 0);
+        tape.entries.push_back(std::bit_cast<uint64_t>(number));
+        return true;
+    }
+
+    bool on_int64(int64_t number)
+    {
+        append('l', 0);
+        tape.entries.push_back(static_cast<uint64_t>(number));
+        return true;
+    }
+
+    bool on_uint64(uint64_t number)
+    {
+        append('u', 0);
+        tape.entries.push_back(number);
+        return true;
+    }
+
+    bool on_string(std::string_view str, bool)
+    {
+        append('"', tape.strings.size());
+        append_string(str);
+        return true;
+    }
+
+    bool on_key(std::string_view key, bool)
+    {
+        tape.entries.push_back(uint64_t('"') << 56 | tape.strings.size());
+        append_string(key);
+        return true;
+    }
+
+    bool on_object_begin() { open('{'); return true; }
+    bool on_array_begin() { open('['); return true; }
+    bool on_object_end() { close('}'); return true; }
+    bool on_array_end() { close(']'); return true; }
+
+private:
+    // Every value counts as one element of the enclosing scope
+    void append(char tag, uint64_t payload)
+    {
+        tape.entries.push_back(uint64_t(static_cast<unsigned char>(tag)) << 56 | payload);
+        counts.back()++;
+    }
+
+    void append_string(std::string_view str)
+    {
+        assert(str.size() <= UINT32_MAX);
+        uint32_t size = static_cast<uint32_t>(str.size());
+        tape.strings.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        tape.strings.append(str);
+    }
+
+    void open(char tag)
+    {
+        append(tag, 0);
+        scopes.push_back(tape.entries.size() - 1);
+        counts.push_back(0);
+    }
+
+    void close(char tag)
+    {
+        size_t start = scopes.back();
+        uint64_t count = std::min<uint64_t>(counts.back(), 0xFFFFFF);
+        scopes.pop_back();
+        counts.pop_back();
+        tape.entries.push_back(uint64_t(static_cast<unsigned char>(tag)) << 56 | start);
+        assert(tape.entries.size() <= UINT32_MAX);
+        tape.entries[start] |= count << 32 | tape.entries.size();
+    }
+
+    JSON_Tape& tape;
+    std::vector<size_t> scopes;
+    std::vector<size_t> counts{0}; // values per open scope, outermost for the root
+};
+
+inline void JSON_Tape::parse(std::string_view input)
+{
+    entries.clear();
+    strings.clear();
+    JSON_Tape_Builder builder(*this);
+    JSON_Parser::read(input, builder);
+}
+
+inline void JSON_Tape::assign(const JSON_Value& value)
+{
+    entries.clear();
+    strings.clear();
+    JSON_Tape_Builder builder(*this);
+    value.emit(builder);
+}
+
+inline JSON_Tape_Ref JSON_Tape::root() const
+{
+    assert(!entries.empty());
+    return JSON_Tape_Ref(*this, 0);
+}
+
+// Returns the first character after the value starting at p. The input must
+// already be validated: only quotes and brackets are looked at.
+static const char *json_skip_value(const char *p, const char *end)
+{
+    size_t depth = 0;
+    do
+    {
+        char c = *p;
+        if (c == '"')
+        {
+            bool escaped = false, dangling;
+            p = json_find_string_end(p + 1, end, escaped, dangling) + 1;
+        }
+        else if (c == '{' || c == '[')
+        {
+            depth++;
+            p++;
+        }
+        else if (c == '}' || c == ']')
+        {
+            depth--;
+            p++;
+        }
+        else if (depth == 0)
+        {
+            while (p < end && !json_is_delimiter(*p))
+            {
+                p++;
+            }
+        }
+        else
+        {
+            p++;
+        }
+    } while (depth > 0 && p < end);
+    return p;
+}
+
+static const char *json_skip_space(const char *p, const char *end)
+{
+    while (p < end && json_is_space(*p))
+    {
+        p++;
+    }
+    return p;
+}
+
+// A value inside the text of a JSON_Lazy_Document. Nothing is parsed until an
+// accessor asks for it, and members or elements before the requested one are
+// skipped without being decoded. Lookups are linear in the text they skip and
+// take the first of duplicate keys, where a parsed tree keeps the last value.
+struct JSON_Lazy_Value
+{
+    JSON_Type type() const;
+
+    bool is_null() const
+    {
+        return *begin == 'n';
+    }
+
+    bool boolean() const
+    {
+        assert(*begin == 't' || *begin == 'f');
+        return *begin == 't';
+    }
+
+    double number() const;
+    int64_t int64() const;
+    uint64_t uint64() const;
+
+    // Decodes escapes when the string has any
+    std::string string() const;
+
+    // The text of the value, as found in the input
+    std::string_view text() const
+    {
+        return {begin, static_cast<size_t>(json_skip_value(begin, end) - begin)};
+    }
+
+    size_t size() const;
+
+    // Throws std::out_of_range like the const JSON_Value accessors
+    JSON_Lazy_Value operator[](std::string_view key) const;
+    JSON_Lazy_Value operator[](size_t index) const;
+
+    // Member lookup; false when key is missing
+    bool find(std::string_view key, JSON_Lazy_Value& value) const;
+
+    JSON_Value to_value() const
+    {
+        return JSON_Parser::parse(text());
+    }
+
+private:
+    friend struct JSON_Lazy_Document;
+
+    JSON_Lazy_Value(const char *begin, const char *end) : begin(begin), end(end) {}
+
+    JSON_Variant parse_number() const;
+
+    const char *begin; // first character of the value
+    const char *end;   // end of the document
+};
+
+// Validates input once and then reads values out of it on demand. The input is
+// not copied and has to outlive the document and every value taken from it.
+struct JSON_Lazy_Document
+{
+    explicit JSON_Lazy_Document(std::string_view input) : input(input)
+    {
+        JSON_Handler validator;
+        JSON_Parser::read(input, validator);
+    }
+
+    JSON_Lazy_Value root() const
+    {
+        return {json_skip_space(input.data(), input.data() + input.size()), input.data() + input.size()};
+    }
+
+private:
+    std::string_view input;
+};
+
+inline JSON_Type JSON_Lazy_Value::type() const
+{
+    switch (*begin)
+    {
+        case 't':
+        case 'f':
+            return JSON_Type::BOOLEAN;
+        case '"':
+            return JSON_Type::STRING;
+        case '[':
+            return JSON_Type::ARRAY;
+        case '{':
+            return JSON_Type::OBJECT;
+        case 'n':
+            return JSON_Type::NIL;
+        default:
+            return JSON_Type::NUMBER;
+    }
+}
+
+inline JSON_Variant JSON_Lazy_Value::parse_number() const
+{
+    assert(type() == JSON_Type::NUMBER);
+    const char *last = begin;
+    while (last < end && !json_is_delimiter(*last))
+    {
+        last++;
+    }
+    JSON_Variant number;
+    json_parse_number(begin, last, number);
+    return number;
+}
+
+inline double JSON_Lazy_Value::number() const
+{
+    return std::visit([](const auto& number) -> double {
+        if constexpr (std::is_arithmetic_v<std::decay_t<decltype(number)>>)
+        {
+            return static_cast<double>(number);
+        }
+        return 0;
+    }, parse_number());
+}
+
+inline int64_t JSON_Lazy_Value::int64() const
+{
+    JSON_Variant number = parse_number();
+    if (const uint64_t *u = std::get_if<uint64_t>(&number))
+    {
+        assert(*u <= INT64_MAX);
+        return static_cast<int64_t>(*u);
+    }
+    return std::get<int64_t>(number);
+}
+
+inline uint64_t JSON_Lazy_Value::uint64() const
+{
+    JSON_Variant number = parse_number();
+    if (const int64_t *i = std::get_if<int64_t>(&number))
+    {
+        assert(*i >= 0);
+        return static_cast<uint64_t>(*i);
+    }
+    return std::get<uint64_t>(number);
+}
+
+inline std::string JSON_Lazy_Value::string() const
+{
+    assert(*begin == '"');
+    bool escaped = false, dangling;
+    const char *close = json_find_string_end(begin + 1, end, escaped, dangling);
+    std::string_view raw(begin + 1, close - begin - 1);
+    if (!escaped)
+    {
+        return std::string(raw);
+    }
+    JSON_String decoded;
+    json_unescape(raw, decoded);
+    return std::string(decoded);
+}
+
+inline size_t JSON_Lazy_Value::size() const
+{
+    assert(*begin == '[' || *begin == '{');
+    char close = *begin == '[' ? ']' : '}';
+    const char *p = json_skip_space(begin + 1, end);
+    size_t count = 0;
+    while (*p != close)
+    {
+        count++;
+        if (close == '}')
+        {
+            p = json_skip_space(json_skip_value(p, end), end) + 1; // key and ':'
+            p = json_skip_space(p, end);
+        }
+        p = json_skip_space(json_skip_value(p, end), end);
+        if (*p == ',')
+        {
+            p = json_skip_space(p + 1, end);
+        }
+    }
+    return count;
+}
+
+inline bool JSON_Lazy_Value::find(std::string_view key, JSON_Lazy_Value& value) const
+{
+    assert(*begin == '{');
+    JSON_String decoded;
+    const char *p = json_skip_space(begin + 1, end);
+    while (*p == '"')
+    {
+        bool escaped = false, dangling;
+        const char *close = json_find_string_end(p + 1, end, escaped, dangling);
+        std::string_view name(p + 1, close - p - 1);
+        if (escaped)
+        {
+            decoded.clear();
+            json_unescape(name, decoded);
+            name = decoded;
+        }
+        p = json_skip_space(json_skip_space(close + 1, end) + 1, end);
+        if (name == key)
+        {
+            value = JSON_Lazy_Value(p, end);
+            return true;
+        }
+        p = json_skip_space(json_skip_value(p, end), end);
+        if (*p == ',')
+        {
+            p = json_skip_space(p + 1, end);
+        }
+    }
+    return false;
+}
+
+inline JSON_Lazy_Value JSON_Lazy_Value::operator[](std::string_view key) const
+{
+    JSON_Lazy_Value value = *this;
+    if (!find(key, value))
+    {
+        throw std::out_of_range("JSON_Lazy_Value::operator[]");
+    }
+    return value;
+}
+
+inline JSON_Lazy_Value JSON_Lazy_Value::operator[](size_t index) const
+{
+    assert(*begin == '[');
+    const char *p = json_skip_space(begin + 1, end);
+    while (*p != ']')
+    {
+        if (index-- == 0)
+        {
+            return JSON_Lazy_Value(p, end);
+        }
+        p = json_skip_space(json_skip_value(p, end), end);
+        if (*p == ',')
+        {
+            p = json_skip_space(p + 1, end);
+        }
+    }
+    throw std::out_of_range("JSON_Lazy_Value::operator[]");
+}
+
+// A compiled RFC 6901 JSON Pointer such as "/payload/user/id". Reference
+// tokens are unescaped, hashed and converted to array indices once, so a
+// lookup does no allocation and at most one key comparison per level. As an
+// extension a "*" token matches every member or element; a member literally
+// named "*" cannot be addressed.
+struct JSON_Pointer
+{
+    struct Token
+    {
+        std::string key;
+        size_t hash;
+        size_t index;  // npos unless key is an array index
+        bool wildcard;
+
+        bool matches(std::string_view name) const
+        {
+            return wildcard || name == key;
+        }
+
+        bool matches(size_t position) const
+        {
+            return wildcard || position == index;
+        }
+    };
+
+    // Throws JSON_Error for a malformed pointer
+    explicit JSON_Pointer(std::string_view pointer);
+
+    // The first value the pointer refers to, or nullptr
+    const JSON_Value *find(const JSON_Value& root) const;
+    JSON_Value *find(JSON_Value& root) const;
+
+    // Calls callback with every value the pointer refers to, in document order
+    template <typename Callback>
+    void select(const JSON_Value& root, Callback&& callback) const;
+
+    // Parses input and calls callback with each matching value as a
+    // JSON_Value&&, building nothing else. Without a wildcard the parse stops
+    // at the first match, so the rest of the input is not validated. Returns
+    // the number of matches.
+    template <typename Callback>
+    size_t extract(std::string_view input, Callback&& callback, const JSON_Parse_Options& options = {}) const;
+
+    bool has_wildcard() const;
+
+    std::vector<Token> tokens;
+
+private:
+    // callback returns false to stop the walk
+    template <typename Value, typename Callback>
+    bool walk(Value& value, size_t depth, Callback& callback) const;
+};
+
+inline JSON_Pointer::JSON_Pointer(std::string_view pointer)
+{
+    if (!pointer.empty() && pointer[0] != '/')
+    {
+        throw JSON_Error("JSON pointer must start with '/'", 0);
+    }
+    for (size_t i = 0; i < pointer.size();)
+    {
+        Token token;
+        for (i++; i < pointer.size() && pointer[i] != '/'; i++)
+        {
+            if (pointer[i] != '~')
+            {
+                token.key.push_back(pointer[i]);
+            }
+            else if (i + 1 < pointer.size() && (pointer[i + 1] == '0' || pointer[i + 1] == '1'))
+            {
+                token.key.push_back(pointer[++i] == '0' ? '~' : '/');
+            }
+            else
+            {
+                throw JSON_Error("Invalid escape in JSON pointer", i);
+            }
+        }
+        token.hash = JSON_Object::hash(token.key);
+        token.wildcard = token.key == "*";
+        // Indices are "0" or digits without a leading zero
+        token.index = std::string::npos;
+        const std::string& key = token.key;
+        if (!key.empty() && (key == "0" || key[0] != '0'))
+        {
+            size_t index;
+            auto [end, error] = std::from_chars(key.data(), key.data() + key.size(), index);
+            if (error == std::errc() && end == key.data() + key.size())
+            {
+                token.index = index;
+            }
+        }
+        tokens.push_back(std::move(token));
+    }
+}
+
+inline bool JSON_Pointer::has_wildcard() const
+{
+    return std::any_of(tokens.begin(), tokens.end(), [](const Token& token) { return token.wildcard; });
+}
+
+template <typename Value, typename Callback>
+bool JSON_Pointer::walk(Value& value, size_t depth, Callback& callback) const
+{
+    if (depth == tokens.size())
+    {
+        return callback(value);
+    }
+    const Token& token = tokens[depth];
+    if (value.type() == JSON_Type::OBJECT)
+    {
+        auto& object = value.object();
+        if (!token.wildcard)
+        {
+            auto member = object.find(token.key, token.hash);
+            return member == object.end() || walk(member->second, depth + 1, callback);
+        }
+        for (auto& [key, member] : object)
+        {
+            if (!walk(member, depth + 1, callback))
+            {
+                return false;
+            }
+        }
+    }
+    else if (value.type() == JSON_Type::ARRAY)
+    {
+        auto& array = value.array();
+        if (!token.wildcard)
+        {
+            return token.index >= array.size() || walk(array[token.index], depth + 1, callback);
+        }
+        for (auto& element : array)
+        {
+            if (!walk(element, depth + 1, callback))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+inline const JSON_Value *JSON_Pointer::find(const JSON_Value& root) const
+{
+    const JSON_Value *found = nullptr;
+    auto first = [&](const JSON_Value& value) { found = &value; return false; };
+    walk(root, 0, first);
+    return found;
+}
+
+inline JSON_Value *JSON_Pointer::find(JSON_Value& root) const
+{
+    JSON_Value *found = nullptr;
+    auto first = [&](JSON_Value& value) { found = &value; return false; };
+    walk(root, 0, first);
+    return found;
+}
+
+template <typename Callback>
+void JSON_Pointer::select(const JSON_Value& root, Callback&& callback) const
+{
+    auto each = [&](const JSON_Value& value) { callback(value); return true; };
+    walk(root, 0, each);
+}
+
+// Reader events filtered through a JSON_Pointer: only matching values are
+// built, everything else is tokenized and dropped. Containers outside the
+// pointer's prefix are not tracked at all.
+template <typename Callback>
+struct JSON_Pointer_Filter : JSON_Handler
+{
+    JSON_Pointer_Filter(const JSON_Pointer& pointer, Callback& callback, const JSON_Parse_Options& options)
+        : tokens(pointer.tokens), callback(callback), builder(options), stop_after_match(!pointer.has_wildcard()) {}
+
+    bool on_null() { return scalar([](JSON_DOM_Builder& b) { return b.on_null(); }); }
+    bool on_bool(bool boolean) { return scalar([&](JSON_DOM_Builder& b) { return b.on_bool(boolean); }); }
+    bool on_number(double number) { return scalar([&](JSON_DOM_Builder& b) { return b.on_number(number); }); }
+    bool on_int64(int64_t number) { return scalar([&](JSON_DOM_Builder& b) { return b.on_int64(number); }); }
+    bool on_uint64(uint64_t number) { return scalar([&](JSON_DOM_Builder& b) { return b.on_uint64(number); }); }
+
+    bool on_string(std::string_view str, bool in_input)
+    {
+        return scalar([&](JSON_DOM_Builder& b) { return b.on_string(str, in_input); });
+    }
+
+    bool on_key(std::string_view key, bool in_input)
+    {
+        if (capture_depth > 0)
+        {
+            return builder.on_key(key, in_input);
+        }
+        Frame& top = frames.back();
+        top.child = top.prefix && tokens[frames.size() - 1].matches(key);
+        return true;
+    }
+
+    bool on_object_begin() { return open(false, [](JSON_DOM_Builder& b) { return b.on_object_begin(); }); }
+    bool on_array_begin() { return open(true, [](JSON_DOM_Builder& b) { return b.on_array_begin(); }); }
+    bool on_object_end() { return close([](JSON_DOM_Builder& b) { return b.on_object_end(); }); }
+    bool on_array_end() { return close([](JSON_DOM_Builder& b) { return b.on_array_end(); }); }
+
+    size_t matches = 0;
+
+private:
+    struct Frame
+    {
+        bool array;
+        bool prefix;      // the path to this container matches the pointer so far
+        bool child;       // ... and so does the current member or element
+        size_t next = 0;  // index of the next element
+    };
+
+    // Whether the value that starts now is on the pointer's path; its depth
+    // is frames.size()
+    bool on_path()
+    {
+        if (frames.empty())
+        {
+            return true;
+        }
+        Frame& top = frames.back();
+        if (top.array)
+        {
+            top.child = top.prefix && tokens[frames.size() - 1].matches(top.next);
+            top.next++;
+        }
+        return top.child;
+    }
+
+    bool deliver()
+    {
+        callback(builder.release());
+        matches++;
+        return !stop_after_match;
+    }
+
+    template <typename Event>
+    bool scalar(Event event)
+    {
+        if (capture_depth > 0)
+        {
+            return event(builder);
+        }
+        if (on_path() && frames.size() == tokens.size())
+        {
+            event(builder);
+            return deliver();
+        }
+        return true;
+    }
+
+    template <typename Event>
+    bool open(bool array, Event event)
+    {
+        if (capture_depth > 0)
+        {
+            capture_depth++;
+            return event(builder);
+        }
+        bool path = on_path();
+        if (path && frames.size() == tokens.size())
+        {
+            capture_depth = 1;
+            return event(builder);
+        }
+        frames.push_back({array, path, false});
+        return true;
+    }
+
+    template <typename Event>
+    bool close(Event event)
+    {
+        if (capture_depth > 0)
+        {
+            event(builder);
+            return --capture_depth > 0 || deliver();
+        }
+        frames.pop_back();
+        return true;
+    }
+
+    const std::vector<JSON_Pointer::Token>& tokens;
+    Callback& callback;
+    JSON_DOM_Builder builder;
+    bool stop_after_match;
+    std::vector<Frame> frames; // open containers outside a match
+    size_t capture_depth = 0;  // open containers inside a match
+};
+
+template <typename Callback>
+size_t JSON_Pointer::extract(std::string_view input, Callback&& callback, const JSON_Parse_Options& options) const
+{
+    JSON_Pointer_Filter<Callback> filter(*this, callback, options);
+    JSON_Parser::read(input, filter, options);
+    return filter.matches;
+}
+
+inline bool JSON_Value::operator==(const JSON_Value& other) const
+{
+    if (type() != other.type())
+    {
+        return false;
+    }
+    switch (type())
+    {
+        case JSON_Type::BOOLEAN:
+            return boolean() == other.boolean();
+        case JSON_Type::NUMBER:
+            if (is_int64() && other.is_int64())
+            {
+                return int64() == other.int64();
+            }
+            if (is_uint64() && other.is_uint64())
+            {
+                return uint64() == other.uint64();
+            }
+            return number() == other.number();
+        case JSON_Type::STRING:
+            return string_view() == other.string_view();
+        case JSON_Type::ARRAY:
+            return array() == other.array();
+        case JSON_Type::OBJECT: {
+            const JSON_Object& members = object();
+            const JSON_Object& others = other.object();
+            if (members.size() != others.size())
+            {
+                return false;
+            }
+            for (const auto& [key, value] : members)
+            {
+                auto match = others.find(key);
+                if (match == others.end() || !(value == match->second))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        default:
+            return true;
+    }
+}
+
+// Appends token to a JSON pointer, escaping '~' and '/'
+static void json_pointer_append(std::string& pointer, std::string_view token)
+{
+    pointer.push_back('/');
+    for (char c : token)
+    {
+        if (c == '~')
+        {
+            pointer.append("~0");
+        }
+        else if (c == '/')
+        {
+            pointer.append("~1");
+        }
+        else
+        {
+            pointer.push_back(c);
+        }
+    }
+}
+
+static void json_pointer_append(std::string& pointer, size_t index)
+{
+    char digits[24];
+    char *end = std::to_chars(digits, digits + sizeof(digits), index).ptr;
+    pointer.push_back('/');
+    pointer.append(digits, end - digits);
+}
+
+static void json_patch_operation(JSON_Array& patch, const char *op, const std::string& path,
+                                 const JSON_Value *value = nullptr)
+{
+    JSON_Value& operation = patch.emplace_back(JSON_Object());
+    operation.emplace("op", op);
+    operation.emplace("path", path);
+    if (value)
+    {
+        operation.emplace("value", *value);
+    }
+}
+
+// path is the pointer to from and to; it is restored before returning
+static void json_diff(const JSON_Value& from, const JSON_Value& to, std::string& path, JSON_Array& patch)
+{
+    size_t length = path.size();
+    if (from.type() == JSON_Type::OBJECT && to.type() == JSON_Type::OBJECT)
+    {
+        const JSON_Object& before = from.object();
+        const JSON_Object& after = to.object();
+        for (const auto& [key, value] : before)
+        {
+            if (!after.contains(key))
+            {
+                json_pointer_append(path, key);
+                json_patch_operation(patch, "remove", path);
+                path.resize(length);
+            }
+        }
+        for (const auto& [key, value] : after)
+        {
+            json_pointer_append(path, key);
+            auto member = before.find(key);
+            if (member == before.end())
+            {
+                json_patch_operation(patch, "add", path, &value);
+            }
+            else
+            {
+                json_diff(member->second, value, path, patch);
+            }
+            path.resize(length);
+        }
+        return;
+    }
+    if (from.type() == JSON_Type::ARRAY && to.type() == JSON_Type::ARRAY)
+    {
+        const JSON_Array& before = from.array();
+        const JSON_Array& after = to.array();
+        size_t prefix = 0;
+        while (prefix < before.size() && prefix < after.size() && before[prefix] == after[prefix])
+        {
+            prefix++;
+        }
+        size_t suffix = 0;
+        while (suffix < before.size() - prefix && suffix < after.size() - prefix &&
+               before[before.size() - 1 - suffix] == after[after.size() - 1 - suffix])
+        {
+            suffix++;
+        }
+        size_t removed_end = before.size() - suffix;
+        size_t added_end = after.size() - suffix;
+        size_t common_end = std::min(removed_end, added_end);
+        for (size_t i = prefix; i < common_end; i++)
+        {
+            json_pointer_append(path, i);
+            json_diff(before[i], after[i], path, patch);
+            path.resize(length);
+        }
+        // Removed from the back so the indices still hold
+        for (size_t i = removed_end; i-- > common_end;)
+        {
+            json_pointer_append(path, i);
+            json_patch_operation(patch, "remove", path);
+            path.resize(length);
+        }
+        for (size_t i = common_end; i < added_end; i++)
+        {
+            json_pointer_append(path, i);
+            json_patch_operation(patch, "add", path, &after[i]);
+            path.resize(length);
+        }
+        return;
+    }
+    if (!(from == to))
+    {
+        json_patch_operation(patch, "replace", path, &to);
+    }
+}
+
+inline JSON_Value JSON_Value::diff(const JSON_Value& from, const JSON_Value& to)
+{
+    JSON_Array patch;
+    std::string path;
+    json_diff(from, to, path, patch);
+    return patch;
+}
+
+// Follows the first depth tokens of pointer, reading every token literally:
+// "*" is a key here, not a wildcard. nullptr if the path does not exist.
+static JSON_Value *json_patch_walk(JSON_Value& root, const JSON_Pointer& pointer, size_t depth)
+{
+    JSON_Value *value = &root;
+    for (size_t i = 0; i < depth; i++)
+    {
+        const JSON_Pointer::Token& token = pointer.tokens[i];
+        if (value->type() == JSON_Type::OBJECT)
+        {
+            auto member = value->object().find(token.key, token.hash);
+            if (member == value->object().end())
+            {
+                return nullptr;
+            }
+            value = &member->second;
+        }
+        else if (value->type() == JSON_Type::ARRAY && token.index < value->array().size())
+        {
+            value = &value->array()[token.index];
+        }
+        else
+        {
+            return nullptr;
+        }
+    }
+    return value;
+}
+
+// Container an add of a non-empty path writes into, or nullptr when the
+// path cannot be added
+static JSON_Value *json_patch_add_parent(JSON_Value& root, const JSON_Pointer& path)
+{
+    JSON_Value *parent = json_patch_walk(root, path, path.tokens.size() - 1);
+    const JSON_Pointer::Token& last = path.tokens.back();
+    if (parent && (parent->type() == JSON_Type::OBJECT ||
+                   (parent->type() == JSON_Type::ARRAY && (last.key == "-" || last.index <= parent->array().size()))))
+    {
+        return parent;
+    }
+    return nullptr;
+}
+
+// value is only moved from when the add succeeds
+static void json_patch_add(JSON_Value& root, const JSON_Pointer& path, JSON_Value&& value, size_t operation)
+{
+    if (path.tokens.empty())
+    {
+        root = std::move(value);
+        return;
+    }
+    JSON_Value *parent = json_patch_add_parent(root, path);
+    if (!parent)
+    {
+        throw JSON_Patch_Error("JSON patch path does not exist", operation);
+    }
+    const JSON_Pointer::Token& last = path.tokens.back();
+    if (parent->type() == JSON_Type::OBJECT)
+    {
+        parent->object().insert_or_assign(last.key, std::move(value));
+        return;
+    }
+    JSON_Array& array = parent->array();
+    if (last.key == "-")
+    {
+        array.push_back(std::move(value));
+        return;
+    }
+    array.insert(array.begin() + last.index, std::move(value));
+}
+
+static JSON_Value json_patch_remove(JSON_Value& root, const JSON_Pointer& path, size_t operation)
+{
+    JSON_Value *parent = path.tokens.empty() ? nullptr : json_patch_walk(root, path, path.tokens.size() - 1);
+    const JSON_Pointer::Token *last = path.tokens.empty() ? nullptr : &path.tokens.back();
+    if (parent && parent->type() == JSON_Type::OBJECT)
+    {
+        JSON_Object& object = parent->object();
+        auto member = object.find(last->key, last->hash);
+        if (member != object.end())
+        {
+            JSON_Value removed = std::move(member->second);
+            object.erase(last->key);
+            return removed;
+        }
+    }
+    else if (parent && parent->type() == JSON_Type::ARRAY && last->index < parent->array().size())
+    {
+        JSON_Array& array = parent->array();
+        JSON_Value removed = std::move(array[last->index]);
+        array.erase(array.begin() + last->index);
+        return removed;
+    }
+    throw JSON_Patch_Error("JSON patch path does not exist", operation);
+}
+
+static const JSON_Value *json_patch_member(const JSON_Value& operation, std::string_view name)
+{
+    auto member = operation.object().find(name);
+    return member == operation.object().end() ? nullptr : &member->second;
+}
+
+static JSON_Pointer json_patch_pointer(const JSON_Value& operation, std::string_view name, size_t index)
+{
+    const JSON_Value *pointer = json_patch_member(operation, name);
+    if (!pointer || pointer->type() != JSON_Type::STRING)
+    {
+        throw JSON_Patch_Error("JSON patch operation is missing a pointer", index);
+    }
+    try
+    {
+        return JSON_Pointer(pointer->string_view());
+    }
+    catch (const JSON_Error& error)
+    {
+        throw JSON_Patch_Error(error.what(), index);
+    }
+}
+
+inline void JSON_Value::apply_patch(const JSON_Value& patch)
+{
+    if (patch.type() != JSON_Type::ARRAY)
+    {
+        throw JSON_Patch_Error("JSON patch must be an array", 0);
+    }
+    const JSON_Array& operations = patch.array();
+    for (size_t i = 0; i < operations.size(); i++)
+    {
+        const JSON_Value& operation = operations[i];
+        const JSON_Value *op = operation.type() == JSON_Type::OBJECT ? json_patch_member(operation, "op") : nullptr;
+        if (!op || op->type() != JSON_Type::STRING)
+        {
+            throw JSON_Patch_Error("JSON patch operation without \"op\"", i);
+        }
+        std::string_view name = op->string_view();
+        JSON_Pointer path = json_patch_pointer(operation, "path", i);
+        const JSON_Value *value = json_patch_member(operation, "value");
+        bool needs_value = name == "add" || name == "replace" || name == "test";
+        if (needs_value && !value)
+        {
+            throw JSON_Patch_Error("JSON patch operation without \"value\"", i);
+        }
+        if (name == "add")
+        {
+            json_patch_add(*this, path, JSON_Value(*value), i);
+        }
+        else if (name == "remove")
+        {
+            json_patch_remove(*this, path, i);
+        }
+        else if (name == "replace")
+        {
+            JSON_Value *target = json_patch_walk(*this, path, path.tokens.size());
+            if (!target)
+            {
+                throw JSON_Patch_Error("JSON patch path does not exist", i);
+            }
+            *target = *value;
+        }
+        else if (name == "move")
+        {
+            JSON_Pointer source = json_patch_pointer(operation, "from", i);
+            std::string_view from = json_patch_member(operation, "from")->string_view();
+            std::string_view to = json_patch_member(operation, "path")->string_view();
+            if (from == to)
+            {
+                continue;
+            }
+            if (to.starts_with(from) && to[from.size()] == '/')
+            {
+                throw JSON_Patch_Error("JSON patch cannot move a value into itself", i);
+            }
+            // A failing move leaves the document as it was. Removing an
+            // object member cannot change whether the path can be added, so
+            // that is checked first; removing an array element shifts the
+            // ones after it, so that element is put back instead.
+            JSON_Value *source_parent = source.tokens.empty() ? nullptr
+                                                               : json_patch_walk(*this, source, source.tokens.size() - 1);
+            if (source_parent && source_parent->type() == JSON_Type::OBJECT && !path.tokens.empty() &&
+                !json_patch_add_parent(*this, path))
+            {
+                throw JSON_Patch_Error("JSON patch path does not exist", i);
+            }
+            JSON_Value moved = json_patch_remove(*this, source, i);
+            try
+            {
+                json_patch_add(*this, path, std::move(moved), i);
+            }
+            catch (...)
+            {
+                if (source_parent->type() == JSON_Type::ARRAY)
+                {
+                    JSON_Array& array = source_parent->array();
+                    array.insert(array.begin() + source.tokens.back().index, std::move(moved));
+                }
+                throw;
+            }
+        }
+        else if (name == "copy")
+        {
+            JSON_Pointer source = json_patch_pointer(operation, "from", i);
+            const JSON_Value *copied = json_patch_walk(*this, source, source.tokens.size());
+            if (!copied)
+            {
+                throw JSON_Patch_Error("JSON patch path does not exist", i);
+            }
+            json_patch_add(*this, path, JSON_Value(*copied), i);
+        }
+        else if (name == "test")
+        {
+            const JSON_Value *target = json_patch_walk(*this, path, path.tokens.size());
+            if (!target || !(*target == *value))
+            {
+                throw JSON_Patch_Error("JSON patch test failed", i);
+            }
+        }
+        else
+        {
+            throw JSON_Patch_Error("Unknown JSON patch operation", i);
+        }
+    }
+}
+
+inline void JSON_Value::merge_patch(const JSON_Value& patch)
+{
+    if (patch.type() != JSON_Type::OBJECT)
+    {
+        *this = patch;
+        return;
+    }
+    if (type() != JSON_Type::OBJECT)
+    {
+        *this = JSON_Object();
+    }
+    JSON_Object& members = object();
+    for (const auto& [key, value] : patch.object())
+    {
+        if (value.is_null())
+        {
+            members.erase(key);
+        }
+        else
+        {
+            members[key].merge_patch(value);
+        }
+    }
+}
+
+// Compiled subset of JSON Schema, checked while the input is read: a document
+// is rejected at the first offending token, before the rest of it is parsed
+// and without building a tree. Supported keywords are type, enum, const,
+// minimum, maximum, exclusiveMinimum, exclusiveMaximum, minLength, maxLength,
+// items, minItems, maxItems, properties, required and additionalProperties;
+// annotations such as title are ignored and any other keyword is refused.
+template <typename Next = JSON_Handler>
+struct JSON_Schema_Validator;
+
+struct JSON_Schema
+{
+    // Throws std::invalid_argument for a schema outside the supported subset
+    explicit JSON_Schema(const JSON_Value& schema);
+
+    // Throws JSON_Error at the first violation, or for malformed input
+    void validate(std::string_view input) const;
+
+    // Builds the tree of a valid document in the same pass. Arrays with
+    // minItems and objects with properties start out at that capacity.
+    JSON_Value parse(std::string_view input, const JSON_Parse_Options& options = {},
+                     std::pmr::memory_resource *resource = std::pmr::get_default_resource()) const;
+
+private:
+    template <typename Next>
+    friend struct JSON_Schema_Validator;
+
+    static constexpr size_t none = static_cast<size_t>(-1);
+    static constexpr unsigned integer_type = 1u << 6; // next to one bit per JSON_Type
+
+    struct Property
+    {
+        std::string name;
+        size_t hash;
+        size_t node = 0;
+        bool required = false;
+    };
+
+    // nodes[0] accepts anything
+    struct Node
+    {
+        unsigned types = ~0u;
+        std::vector<JSON_Value> enumeration; // scalars only
+        bool enumerated = false;
+        double minimum = -std::numeric_limits<double>::infinity();
+        double maximum = std::numeric_limits<double>::infinity();
+        double exclusive_minimum = -std::numeric_limits<double>::infinity();
+        double exclusive_maximum = std::numeric_limits<double>::infinity();
+        size_t min_length = 0;
+        size_t max_length = none;
+        size_t items = 0;
+        size_t min_items = 0;
+        size_t max_items = none;
+        std::vector<Property> properties;
+        size_t additional = 0; // none when other members are refused
+    };
+
+    size_t compile(const JSON_Value& schema);
+    Property& property(size_t node, std::string_view name);
+
+    std::vector<Node> nodes;
+    size_t root;
+};
+
+inline JSON_Schema::JSON_Schema(const JSON_Value& schema)
+{
+    nodes.emplace_back();
+    root = compile(schema);
+}
+
+inline JSON_Schema::Property& JSON_Schema::property(size_t node, std::string_view name)
+{
+    std::vector<Property>& properties = nodes[node].properties;
+    for (Property& property : properties)
+    {
+        if (property.name == name)
+        {
+            return property;
+        }
+    }
+    return properties.emplace_back(Property{std::string(name), JSON_Object::hash(name)});
+}
+
+static unsigned json_schema_type(const JSON_Value& name)
+{
+    static const std::pair<std::string_view, unsigned> types[] = {
+        {"null", 1u << static_cast<int>(JSON_Type::NIL)},
+        {"boolean", 1u << static_cast<int>(JSON_Type::BOOLEAN)},
+        {"number", 1u << static_cast<int>(JSON_Type::NUMBER)},
+        {"integer", 1u << 6},
+        {"string", 1u << static_cast<int>(JSON_Type::STRING)},
+        {"array", 1u << static_cast<int>(JSON_Type::ARRAY)},
+        {"object", 1u << static_cast<int>(JSON_Type::OBJECT)},
+    };
+    if (name.type() == JSON_Type::STRING)
+    {
+        for (const auto& [type, bit] : types)
+        {
+            if (name.string_view() == type)
+            {
+                return bit;
+            }
+        }
+    }
+    throw std::invalid_argument("Unknown type in JSON schema");
+}
+
+// Indices may move while the subschemas are compiled, so nodes[index] is
+// looked up again after each one
+inline size_t JSON_Schema::compile(const JSON_Value& schema)
+{
+    if (schema.type() == JSON_Type::BOOLEAN)
+    {
+        if (schema.boolean())
+        {
+            return 0;
+        }
+        nodes.emplace_back().types = 0;
+        return nodes.size() - 1;
+    }
+    if (schema.type() != JSON_Type::OBJECT)
+    {
+        throw std::invalid_argument("JSON schema must be an object or a boolean");
+    }
+    auto count = [](const JSON_Value& value) -> size_t {
+        if (!value.is_uint64())
+        {
+            throw std::invalid_argument("JSON schema length must be a non-negative integer");
+        }
+        return static_cast<size_t>(std::min<uint64_t>(value.uint64(), none));
+    };
+    auto limit = [](const JSON_Value& value) {
+        if (value.type() != JSON_Type::NUMBER)
+        {
+            throw std::invalid_argument("JSON schema bound must be a number");
+        }
+        return value.number();
+    };
+    auto scalars = [](const JSON_Value& value) {
+        if (value.type() == JSON_Type::ARRAY || value.type() == JSON_Type::OBJECT)
+        {
+            throw std::invalid_argument("JSON schema enum and const only support scalars");
+        }
+        return value;
+    };
+    size_t index = nodes.size();
+    nodes.emplace_back();
+    for (const auto& [key, value] : schema.object())
+    {
+        std::string_view name = key;
+        if (name == "type")
+        {
+            unsigned types = 0;
+            if (value.type() == JSON_Type::ARRAY)
+            {
+                for (const JSON_Value& type : value.array())
+                {
+                    types |= json_schema_type(type);
+                }
+            }
+            else
+            {
+                types = json_schema_type(value);
+            }
+            nodes[index].types = types;
+        }
+        else if (name == "enum" || name == "const")
+        {
+            Node& node = nodes[index];
+            node.enumerated = true;
+            if (name == "const")
+            {
+                node.enumeration.push_back(scalars(value));
+            }
+            else if (value.type() == JSON_Type::ARRAY)
+            {
+                for (const JSON_Value& option : value.array())
+                {
+                    node.enumeration.push_back(scalars(option));
+                }
+            }
+            else
+            {
+                throw std::invalid_argument("JSON schema enum must be an array");
+            }
+        }
+        else if (name == "minimum")
+        {
+            nodes[index].minimum = limit(value);
+        }
+        else if (name == "maximum")
+        {
+            nodes[index].maximum = limit(value);
+        }
+        else if (name == "exclusiveMinimum")
+        {
+            nodes[index].exclusive_minimum = limit(value);
+        }
+        else if (name == "exclusiveMaximum")
+        {
+            nodes[index].exclusive_maximum = limit(value);
+        }
+        else if (name == "minLength")
+        {
+            nodes[index].min_length = count(value);
+        }
+        else if (name == "maxLength")
+        {
+            nodes[index].max_length = count(value);
+        }
+        else if (name == "minItems")
+        {
+            nodes[index].min_items = count(value);
+        }
+        else if (name == "maxItems")
+        {
+            nodes[index].max_items = count(value);
+        }
+        else if (name == "items")
+        {
+            size_t items = compile(value);
+            nodes[index].items = items;
+        }
+        else if (name == "properties" && value.type() == JSON_Type::OBJECT)
+        {
+            for (const auto& [member, subschema] : value.object())
+            {
+                size_t node = compile(subschema);
+                property(index, member).node = node;
+            }
+        }
+        else if (name == "required" && value.type() == JSON_Type::ARRAY)
+        {
+            for (const JSON_Value& member : value.array())
+            {
+                if (member.type() != JSON_Type::STRING)
+                {
+                    throw std::invalid_argument("JSON schema required must list strings");
+                }
+                property(index, member.string_view()).required = true;
+            }
+        }
+        else if (name == "additionalProperties")
+        {
+            size_t additional = value.type() == JSON_Type::BOOLEAN && !value.boolean() ? none : compile(value);
+            nodes[index].additional = additional;
+        }
+        else if (name != "title" && name != "description" && name != "default" && name != "examples" &&
+                 name != "$schema" && name != "$id" && name != "$comment" && name != "format")
+        {
+            throw std::invalid_argument("Unsupported JSON schema keyword: " + std::string(name));
+        }
+    }
+    return index;
+}
+
+// Checks reader events against a JSON_Schema and passes them on to next; the
+// first violation stops the parse with error set. Chunked input can be
+// validated with a JSON_Reader over this handler.
+template <typename Next>
+struct JSON_Schema_Validator : JSON_Handler
+{
+    JSON_Schema_Validator(const JSON_Schema& schema, Next& next) : schema(schema), next(next) {}
+
+    bool on_null() { return scalar(JSON_Value()) && next.on_null(); }
+    bool on_bool(bool boolean) { return scalar(boolean) && next.on_bool(boolean); }
+    bool on_number(double number) { return scalar(number) && next.on_number(number); }
+    bool on_int64(int64_t number) { return scalar(number) && next.on_int64(number); }
+    bool on_uint64(uint64_t number) { return scalar(number) && next.on_uint64(number); }
+
+    bool on_string(std::string_view str, bool in_input)
+    {
+        JSON_Value value;
+        value.value = str;
+        return scalar(value) && next.on_string(str, in_input);
+    }
+
+    bool on_key(std::string_view key, bool in_input)
+    {
+        const Frame& top = frames.back();
+        const JSON_Schema::Node& object = schema.nodes[top.node];
+        size_t hash = JSON_Object::hash(key);
+        for (size_t i = 0; i < object.properties.size(); i++)
+        {
+            const JSON_Schema::Property& property = object.properties[i];
+            if (property.hash == hash && property.name == key)
+            {
+                seen[top.seen + i] = true;
+                pending = property.node;
+                return next.on_key(key, in_input);
+            }
+        }
+        if (object.additional == JSON_Schema::none)
+        {
+            return fail("property is not allowed by the schema");
+        }
+        pending = object.additional;
+        return next.on_key(key, in_input);
+    }
+
+    bool on_object_begin()
+    {
+        size_t node = open(JSON_Type::OBJECT);
+        if (node == JSON_Schema::none)
+        {
+            return false;
+        }
+        size_t properties = schema.nodes[node].properties.size();
+        frames.push_back({node, seen.size(), 0});
+        seen.resize(seen.size() + properties, false);
+        if (!next.on_object_begin())
+        {
+            return false;
+        }
+        if constexpr (requires { next.reserve(properties); })
+        {
+            if (properties > 0)
+            {
+                next.reserve(properties);
+            }
+        }
+        return true;
+    }
+
+    bool on_object_end()
+    {
+        const Frame& top = frames.back();
+        const std::vector<JSON_Schema::Property>& properties = schema.nodes[top.node].properties;
+        for (size_t i = 0; i < properties.size(); i++)
+        {
+            if (properties[i].required && !seen[top.seen + i])
+            {
+                return fail("required property is missing");
+            }
+        }
+        seen.resize(top.seen);
+        frames.pop_back();
+        return next.on_object_end();
+    }
+
+    bool on_array_begin()
+    {
+        size_t node = open(JSON_Type::ARRAY);
+        if (node == JSON_Schema::none)
+        {
+            return false;
+        }
+        frames.push_back({node, array_frame, 0});
+        if (!next.on_array_begin())
+        {
+            return false;
+        }
+        if constexpr (requires { next.reserve(size_t()); })
+        {
+            // The bound comes from the schema, not the input, but is capped anyway
+            size_t capacity = std::min<size_t>(schema.nodes[node].min_items, 4096);
+            if (capacity > 0)
+            {
+                next.reserve(capacity);
+            }
+        }
+        return true;
+    }
+
+    bool on_array_end()
+    {
+        const Frame& top = frames.back();
+        if (top.count < schema.nodes[top.node].min_items)
+        {
+            return fail("array has fewer items than the schema requires");
+        }
+        frames.pop_back();
+        return next.on_array_end();
+    }
+
+    const char *error = nullptr; // set when the parse was stopped
+
+private:
+    static constexpr size_t array_frame = JSON_Schema::none;
+
+    struct Frame
+    {
+        size_t node;
+        size_t seen;  // first flag of the object's properties in seen, array_frame for arrays
+        size_t count; // elements so far
+    };
+
+    bool fail(const char *what)
+    {
+        error = what;
+        return false;
+    }
+
+    // Node of the value starting now, or none if the enclosing array is full
+    size_t begin_value()
+    {
+        if (frames.empty())
+        {
+            return schema.root;
+        }
+        Frame& top = frames.back();
+        if (top.seen != array_frame)
+        {
+            return pending;
+        }
+        const JSON_Schema::Node& array = schema.nodes[top.node];
+        if (++top.count > array.max_items)
+        {
+            fail("array has more items than the schema allows");
+            return JSON_Schema::none;
+        }
+        return array.items;
+    }
+
+    bool allows(const JSON_Schema::Node& node, const JSON_Value& value)
+    {
+        if (node.types & (1u << static_cast<int>(value.type())))
+        {
+            return true;
+        }
+        if (!(node.types & JSON_Schema::integer_type) || value.type() != JSON_Type::NUMBER)
+        {
+            return false;
+        }
+        double number = value.number();
+        return value.is_int64() || value.is_uint64() || (std::isfinite(number) && std::floor(number) == number);
+    }
+
+    size_t open(JSON_Type type)
+    {
+        size_t index = begin_value();
+        if (index == JSON_Schema::none)
+        {
+            return index;
+        }
+        const JSON_Schema::Node& node = schema.nodes[index];
+        if (!(node.types & (1u << static_cast<int>(type))))
+        {
+            fail("value has a type the schema does not allow");
+            return JSON_Schema::none;
+        }
+        if (node.enumerated)
+        {
+            fail("value is not one the schema allows");
+            return JSON_Schema::none;
+        }
+        return index;
+    }
+
+    bool scalar(const JSON_Value& value)
+    {
+        size_t index = begin_value();
+        if (index == JSON_Schema::none)
+        {
+            return false;
+        }
+        const JSON_Schema::Node& node = schema.nodes[index];
+        if (!allows(node, value))
+        {
+            return fail("value has a type the schema does not allow");
+        }
+        if (node.enumerated &&
+            std::none_of(node.enumeration.begin(), node.enumeration.end(),
+                         [&](const JSON_Value& option) { return option == value; }))
+        {
+            return fail("value is not one the schema allows");
+        }
+        if (value.type() == JSON_Type::NUMBER)
+        {
+            double number = value.number();
+            if (number < node.minimum || number > node.maximum || number <= node.exclusive_minimum ||
+                number >= node.exclusive_maximum)
+            {
+                return fail("number is out of the range the schema allows");
+            }
+        }
+        else if (value.type() == JSON_Type::STRING && (node.min_length > 0 || node.max_length != JSON_Schema::none))
+        {
+            // Lengths count code points, i.e. bytes that do not continue a UTF-8 sequence
+            std::string_view str = value.string_view();
+            size_t length = std::count_if(str.begin(), str.end(), [](char c) { return (c & 0xC0) != 0x80; });
+            if (length < node.min_length || length > node.max_length)
+            {
+                return fail("string length is out of the range the schema allows");
+            }
+        }
+        return true;
+    }
+
+    const JSON_Schema& schema;
+    Next& next;
+    std::vector<Frame> frames;
+    std::vector<bool> seen; // properties met so far, per open object
+    size_t pending = 0;     // node of the member whose key was read last
+};
+
+inline void JSON_Schema::validate(std::string_view input) const
+{
+    JSON_Handler events;
+    JSON_Schema_Validator<> validator(*this, events);
+    JSON_Reader<JSON_Schema_Validator<>> reader(validator);
+    if (!reader.feed(input) || !reader.finish())
+    {
+        throw JSON_Error(validator.error, reader.offset());
+    }
+}
+
+inline JSON_Value JSON_Schema::parse(std::string_view input, const JSON_Parse_Options& options,
+                                     std::pmr::memory_resource *resource) const
+{
+    JSON_DOM_Builder builder(options, resource);
+    JSON_Schema_Validator<JSON_DOM_Builder> validator(*this, builder);
+    JSON_Reader<JSON_Schema_Validator<JSON_DOM_Builder>> reader(validator, options);
+    if (!reader.feed(input) || !reader.finish())
+    {
+        throw JSON_Error(validator.error, reader.offset());
+    }
+    return builder.release();
+}
+
+// Binding of user structs to JSON objects. JSON_BIND(Point, x, y) at global
+// scope maps members x and y to the keys "x" and "y"; for other key names,
+// specialize JSON_Binding by hand with a members tuple of JSON_Bound_Member.
+// Members may be bool, arithmetic types, std::string, std::vector and
+// std::optional of those, and other bound structs.
+template <typename T>
+struct JSON_Binding;
+
+template <typename Owner, typename Field>
+struct JSON_Bound_Member
+{
+    std::string_view name;
+    Field Owner::*pointer;
+};
+
+template <typename T>
+concept json_bound = requires { JSON_Binding<T>::members; };
+
+#define JSON_BIND(Type, ...)                                                               \
+    template <>                                                                            \
+    struct JSON_Binding<Type>                                                              \
+    {                                                                                      \
+        using type = Type;                                                                 \
+        static constexpr auto members = std::make_tuple(JSON_BIND_EACH(__VA_ARGS__));      \
+    }
+
+// Expands JSON_Bound_Member{"m", &type::m} for every argument (up to 256)
+#define JSON_BIND_EACH(...) __VA_OPT__(JSON_BIND_EXPAND(JSON_BIND_MEMBER(__VA_ARGS__)))
+#define JSON_BIND_MEMBER(member, ...)                                                      \
+    JSON_Bound_Member{#member, &type::member} __VA_OPT__(, JSON_BIND_AGAIN JSON_BIND_PARENS(__VA_ARGS__))
+#define JSON_BIND_PARENS ()
+#define JSON_BIND_AGAIN() JSON_BIND_MEMBER
+#define JSON_BIND_EXPAND(...) JSON_BIND_EXPAND3(JSON_BIND_EXPAND3(JSON_BIND_EXPAND3(JSON_BIND_EXPAND3(__VA_ARGS__))))
+#define JSON_BIND_EXPAND3(...) JSON_BIND_EXPAND2(JSON_BIND_EXPAND2(JSON_BIND_EXPAND2(JSON_BIND_EXPAND2(__VA_ARGS__))))
+#define JSON_BIND_EXPAND2(...) JSON_BIND_EXPAND1(JSON_BIND_EXPAND1(JSON_BIND_EXPAND1(JSON_BIND_EXPAND1(__VA_ARGS__))))
+#define JSON_BIND_EXPAND1(...) __VA_ARGS__
+
+constexpr uint64_t json_bind_hash(std::string_view key, uint64_t seed)
+{
+    uint64_t hash = 0xcbf29ce484222325 ^ seed;
+    for (char c : key)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3;
+    }
+    return hash ^ (hash >> 32);
+}
+
+// Perfect hash of a bound struct's key names, found at compile time: every
+// name gets its own slot, so a lookup is one hash and one comparison
+template <typename T>
+struct JSON_Bind_Keys
+{
+    static constexpr auto names = std::apply([](const auto&... member) {
+        return std::array<std::string_view, sizeof...(member)>{member.name...};
+    }, JSON_Binding<T>::members);
+    static constexpr size_t count = names.size();
+
+    struct Plan
+    {
+        size_t size; // power of two, 0 if no seed was found
+        uint64_t seed;
+    };
+
+    static constexpr Plan plan = [] {
+        size_t first = std::bit_ceil(std::max<size_t>(count * 2, 1));
+        for (size_t size = first; size <= first * 16; size *= 2)
+        {
+            for (uint64_t seed = 0; seed < 1024; seed++)
+            {
+                std::vector<bool> used(size);
+                bool distinct = true;
+                for (size_t i = 0; i < count && distinct; i++)
+                {
+                    size_t slot = json_bind_hash(names[i], seed) & (size - 1);
+                    distinct = !used[slot];
+                    used[slot] = true;
+                }
+                if (distinct)
+                {
+                    return Plan{size, seed};
+                }
+            }
+        }
+        return Plan{0, 0};
+    }();
+    static_assert(plan.size != 0, "bound member names must be distinct");
+
+    // Member index + 1 per slot, 0 marks an empty slot
+    static constexpr auto slots = [] {
+        std::array<uint16_t, plan.size> slots{};
+        for (size_t i = 0; i < count; i++)
+        {
+            slots[json_bind_hash(names[i], plan.seed) & (plan.size - 1)] = static_cast<uint16_t>(i + 1);
+        }
+        return slots;
+    }();
+
+    // Index of the member named key, or count
+    static size_t lookup(std::string_view key)
+    {
+        size_t slot = slots[json_bind_hash(key, plan.seed) & (plan.size - 1)];
+        return slot != 0 && names[slot - 1] == key ? slot - 1 : count;
+    }
+};
+
+// Calls visit with the bound member at index; does nothing past the end
+template <typename T, typename Visit>
+void json_bind_visit(size_t index, Visit&& visit)
+{
+    [&]<size_t... I>(std::index_sequence<I...>) {
+        ((index == I && (visit(std::get<I>(JSON_Binding<T>::members)), true)) || ...);
+    }(std::make_index_sequence<JSON_Bind_Keys<T>::count>{});
+}
+
+// Type-erased destination of a decoded value; ops is null for values that
+// are skipped
+struct JSON_Bind_Ops;
+struct JSON_Bind_Slot
+{
+    void *target = nullptr;
+    const JSON_Bind_Ops *ops = nullptr;
+};
+
+struct JSON_Bind_Ops
+{
+    bool (*scalar)(void *target, const JSON_Variant& value); // false on a mismatch
+    bool (*begin)(void *target, bool array);
+    JSON_Bind_Slot (*member)(void *target, std::string_view key);
+    JSON_Bind_Slot (*element)(void *target);
+    JSON_Bind_Slot (*unwrap)(void *target); // optionals only: the emplaced value
+};
+
+// Per-type decoding and writing, specialized below for every supported type
+template <typename T>
+struct JSON_Bind_Traits;
+
+struct JSON_Bind_Defaults
+{
+    static constexpr bool optional = false;
+
+    template <typename T>
+    static bool scalar(T&, const JSON_Variant&) { return false; }
+    template <typename T>
+    static bool begin(T&, bool) { return false; }
+    template <typename T>
+    static JSON_Bind_Slot member(T&, std::string_view) { return {}; }
+    template <typename T>
+    static JSON_Bind_Slot element(T&) { return {}; }
+    template <typename T>
+    static JSON_Bind_Slot unwrap(T&) { return {}; }
+};
+
+template <typename T>
+struct JSON_Bind_Erased
+{
+    using Traits = JSON_Bind_Traits<T>;
+
+    static bool scalar(void *target, const JSON_Variant& value) { return Traits::scalar(*static_cast<T*>(target), value); }
+    static bool begin(void *target, bool array) { return Traits::begin(*static_cast<T*>(target), array); }
+    static JSON_Bind_Slot member(void *target, std::string_view key) { return Traits::member(*static_cast<T*>(target), key); }
+    static JSON_Bind_Slot element(void *target) { return Traits::element(*static_cast<T*>(target)); }
+    static JSON_Bind_Slot unwrap(void *target) { return Traits::unwrap(*static_cast<T*>(target)); }
+
+    static constexpr JSON_Bind_Ops ops = {scalar, begin, member, element, Traits::optional ? unwrap : nullptr};
+};
+
+template <typename T>
+JSON_Bind_Slot json_bind_slot(T& target)
+{
+    return {&target, &JSON_Bind_Erased<T>::ops};
+}
+
+template <>
+struct JSON_Bind_Traits<bool> : JSON_Bind_Defaults
+{
+    static bool scalar(bool& target, const JSON_Variant& value)
+    {
+        const bool *boolean = std::get_if<bool>(&value);
+        if (boolean)
+        {
+            target = *boolean;
+        }
+        return boolean != nullptr;
+    }
+
+    template <typename Buffer>
+    static void write(Buffer& out, bool value)
+    {
+        value ? out.append("true", 4) : out.append("false", 5);
+    }
+};
+
+template <typename T>
+    requires (std::is_integral_v<T> && !std::is_same_v<T, bool>)
+struct JSON_Bind_Traits<T> : JSON_Bind_Defaults
+{
+    // Integral doubles such as 1e3 are accepted; out of range values are not
+    static bool scalar(T& target, const JSON_Variant& value)
+    {
+        auto store = [&](auto number) {
+            if (!std::in_range<T>(number))
+            {
+                return false;
+            }
+            target = static_cast<T>(number);
+            return true;
+        };
+        if (const int64_t *number = std::get_if<int64_t>(&value))
+        {
+            return store(*number);
+        }
+        if (const uint64_t *number = std::get_if<uint64_t>(&value))
+        {
+            return store(*number);
+        }
+        const double *number = std::get_if<double>(&value);
+        return number && *number == std::trunc(*number) && *number >= -0x1p63 && *number < 0x1p63 &&
+               store(static_cast<int64_t>(*number));
+    }
+
+    template <typename Buffer>
+    static void write(Buffer& out, T value)
+    {
+        json_write_number(out, value);
+    }
+};
+
+template <std::floating_point T>
+struct JSON_Bind_Traits<T> : JSON_Bind_Defaults
+{
+    static bool scalar(T& target, const JSON_Variant& value)
+    {
+        if (const double *number = std::get_if<double>(&value))
+        {
+            target = static_cast<T>(*number);
+        }
+        else if (const int64_t *integer = std::get_if<int64_t>(&value))
+        {
+            target = static_cast<T>(*integer);
+        }
+        else if (const uint64_t *integer = std::get_if<uint64_t>(&value))
+        {
+            target = static_cast<T>(*integer);
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    template <typename Buffer>
+    static void write(Buffer& out, T value)
+    {
+        json_write_number(out, value);
+    }
+};
+
+template <>
+struct JSON_Bind_Traits<std::string> : JSON_Bind_Defaults
+{
+    static bool scalar(std::string& target, const JSON_Variant& value)
+    {
+        const std::string_view *str = std::get_if<std::string_view>(&value);
+        if (str)
+        {
+            target.assign(*str);
+        }
+        return str != nullptr;
+    }
+
+    template <typename Buffer>
+    static void write(Buffer& out, const std::string& value)
+    {
+        json_write_string(out, value);
+    }
+};
+
+template <typename T>
+struct JSON_Bind_Traits<std::vector<T>> : JSON_Bind_Defaults
+{
+    static bool begin(std::vector<T>& target, bool array)
+    {
+        target.clear();
+        return array;
+    }
+
+    static JSON_Bind_Slot element(std::vector<T>& target)
+    {
+        return json_bind_slot(target.emplace_back());
+    }
+
+    template <typename Buffer>
+    static void write(Buffer& out, const std::vector<T>& value)
+    {
+        out.push_back('[');
+        for (size_t i = 0; i < value.size(); i++)
+        {
+            if (i > 0)
+            {
+                out.push_back(',');
+            }
+            JSON_Bind_Traits<T>::write(out, value[i]);
+        }
+        out.push_back(']');
+    }
+};
+
+// std::vector<bool> has no addressable elements, so its element slot is the
+// vector itself with ops that append the decoded bool
+template <>
+struct JSON_Bind_Traits<std::vector<bool>> : JSON_Bind_Defaults
+{
+    static bool begin(std::vector<bool>& target, bool array)
+    {
+        target.clear();
+        return array;
+    }
+
+    static JSON_Bind_Slot element(std::vector<bool>& target)
+    {
+        return {&target, &append_ops};
+    }
+
+    template <typename Buffer>
+    static void write(Buffer& out, const std::vector<bool>& value)
+    {
+        out.push_back('[');
+        for (size_t i = 0; i < value.size(); i++)
+        {
+            if (i > 0)
+            {
+                out.push_back(',');
+            }
+            JSON_Bind_Traits<bool>::write(out, value[i]);
+        }
+        out.push_back(']');
+    }
+
+private:
+    static bool append(void *target, const JSON_Variant& value)
+    {
+        bool boolean = false;
+        if (!JSON_Bind_Traits<bool>::scalar(boolean, value))
+        {
+            return false;
+        }
+        static_cast<std::vector<bool>*>(target)->push_back(boolean);
+        return true;
+    }
+
+    static constexpr JSON_Bind_Ops append_ops = {
+        append,
+        [](void *, bool) { return false; },
+        [](void *, std::string_view) { return JSON_Bind_Slot{}; },
+        [](void *) { return JSON_Bind_Slot{}; },
+        nullptr,
+    };
+};
+
+// null resets the optional; any other value is decoded into the emplaced T
+template <typename T>
+struct JSON_Bind_Traits<std::optional<T>> : JSON_Bind_Defaults
+{
+    static constexpr bool optional = true;
+
+    static bool scalar(std::optional<T>& target, const JSON_Variant& value)
+    {
+        target.reset();
+        return std::holds_alternative<std::monostate>(value);
+    }
+
+    static JSON_Bind_Slot unwrap(std::optional<T>& target)
+    {
+        return json_bind_slot(target.emplace());
+    }
+
+    template <typename Buffer>
+    static void write(Buffer& out, const std::optional<T>& value)
+    {
+        if (value)
+        {
+            JSON_Bind_Traits<T>::write(out, *value);
+        }
+        else
+        {
+            out.append("null", 4);
+        }
+    }
+};
+
+template <json_bound T>
+struct JSON_Bind_Traits<T> : JSON_Bind_Defaults
+{
+    static bool begin(T&, bool array)
+    {
+        return !array;
+    }
+
+    static JSON_Bind_Slot member(T& target, std::string_view key)
+    {
+        JSON_Bind_Slot slot;
+        json_bind_visit<T>(JSON_Bind_Keys<T>::lookup(key), [&](const auto& member) {
+            slot = json_bind_slot(target.*member.pointer);
+        });
+        return slot;
+    }
+
+    template <typename Buffer>
+    static void write(Buffer& out, const T& value)
+    {
+        out.push_back('{');
+        bool first = true;
+        std::apply([&](const auto&... member) {
+            auto write_member = [&](const auto& member) {
+                if (!first)
+                {
+                    out.push_back(',');
+                }
+                first = false;
+                json_write_string(out, member.name);
+                out.push_back(':');
+                using Field = std::remove_cvref_t<decltype(value.*member.pointer)>;
+                JSON_Bind_Traits<Field>::write(out, value.*member.pointer);
+            };
+            (write_member(member), ...);
+        }, JSON_Binding<T>::members);
+        out.push_back('}');
+    }
+};
+
+// Reader events decoded into a bound value through the slots above
+template <typename T>
+struct JSON_Binder : JSON_Handler
+{
+    explicit JSON_Binder(T& target) : root(json_bind_slot(target)) {}
+
+    bool on_null() { return scalar(std::monostate{}); }
+    bool on_bool(bool boolean) { return scalar(boolean); }
+    bool on_number(double number) { return scalar(number); }
+    bool on_int64(int64_t number) { return scalar(number); }
+    bool on_uint64(uint64_t number) { return scalar(number); }
+    bool on_string(std::string_view str, bool) { return scalar(str); }
+
+    bool on_key(std::string_view key, bool)
+    {
+        if (skip_depth == 0)
+        {
+            const JSON_Bind_Slot& object = frames.back().slot;
+            pending = object.ops->member(object.target, key);
+        }
+        return true;
+    }
+
+    bool on_object_begin() { return open(false); }
+    bool on_array_begin() { return open(true); }
+    bool on_object_end() { return close(); }
+    bool on_array_end() { return close(); }
+
+    const char *error = nullptr; // set when the parse was stopped
+
+private:
+    struct Frame
+    {
+        JSON_Bind_Slot slot;
+        bool array;
+    };
+
+    // Where the value starting now goes
+    JSON_Bind_Slot next(bool null)
+    {
+        JSON_Bind_Slot slot = root;
+        if (!frames.empty())
+        {
+            const Frame& top = frames.back();
+            slot = top.array ? top.slot.ops->element(top.slot.target) : pending;
+        }
+        while (!null && slot.ops && slot.ops->unwrap)
+        {
+            slot = slot.ops->unwrap(slot.target);
+        }
+        return slot;
+    }
+
+    bool scalar(const JSON_Variant& value)
+    {
+        if (skip_depth > 0)
+        {
+            return true;
+        }
+        JSON_Bind_Slot slot = next(std::holds_alternative<std::monostate>(value));
+        return !slot.ops || slot.ops->scalar(slot.target, value) || mismatch();
+    }
+
+    bool open(bool array)
+    {
+        if (skip_depth > 0)
+        {
+            skip_depth++;
+            return true;
+        }
+        JSON_Bind_Slot slot = next(false);
+        if (!slot.ops)
+        {
+            skip_depth = 1;
+            return true;
+        }
+        if (!slot.ops->begin(slot.target, array))
+        {
+            return mismatch();
+        }
+        frames.push_back({slot, array});
+        return true;
+    }
+
+    bool close()
+    {
+        if (skip_depth > 0)
+        {
+            skip_depth--;
+        }
+        else
+        {
+            frames.pop_back();
+        }
+        return true;
+    }
+
+    bool mismatch()
+    {
+        error = "value does not match the bound type";
+        return false;
+    }
+
+    JSON_Bind_Slot root;
+    JSON_Bind_Slot pending; // member slot of the last key
+    std::vector<Frame> frames;
+    size_t skip_depth = 0;  // open containers inside a skipped value
+};
+
+template <typename T>
+T JSON_Parser::decode(std::string_view input)
+{
+    T value{};
+    JSON_Binder<T> binder(value);
+    JSON_Reader<JSON_Binder<T>> reader(binder);
+    if (!reader.feed(input) || !reader.finish())
+    {
+        throw JSON_Error(binder.error, reader.offset());
+    }
+    return value;
+}
+
+// Serializes a bound value like JSON_Value::write, without building a tree
+template <typename Buffer, typename T>
+void json_write(Buffer& out, const T& value)
+{
+    JSON_Bind_Traits<T>::write(out, value);
+}
+
+template <typename T>
+std::string json_to_string(const T& value)
+{
+    std::string out;
+    json_write(out, value);
+    return out;
+}
+
+// Column-wise decoding of an array of records, such as
+// [{"ts":1,"v":2.5,"tag":"a"}, ...]: each field goes into one contiguous
+// vector instead of every record becoming an object of variants, so a column
+// can be scanned with plain loops and takes a fraction of the memory. Values
+// must be scalars; null and absent fields are cells marked not present.
+struct JSON_Columns
+{
+    enum class Kind
+    {
+        NIL,     // only nulls so far
+        BOOLEAN,
+        INT64,
+        DOUBLE,
+        STRING,
+    };
+
+    // One cell per row in present and in the storage of its kind
+    struct Column
+    {
+        std::string name;
+        Kind kind = Kind::NIL;
+        std::vector<uint8_t> present;  // 0 where the field was null or absent
+        std::vector<uint8_t> booleans;
+        std::vector<int64_t> int64s;
+        std::vector<double> doubles;
+        std::string bytes;             // the strings back to back
+        std::vector<size_t> ends;      // where each string ends in bytes
+
+        size_t size() const
+        {
+            return present.size();
+        }
+
+        std::string_view string(size_t row) const
+        {
+            assert(kind == Kind::STRING);
+            size_t begin = row == 0 ? 0 : ends[row - 1];
+            return std::string_view(bytes).substr(begin, ends[row] - begin);
+        }
+    };
+
+    // Columns and their kinds follow the input: a field is a column from the
+    // record it first appears in, and integer columns turn into doubles when
+    // a fraction shows up. Throws JSON_Error for malformed input, for nested
+    // values and for fields whose values change kind otherwise.
+    static JSON_Columns parse(std::string_view input);
+
+    // Only the fields in shape are decoded, into columns of the given kinds
+    // in that order; other fields are skipped, nested or not. Throws
+    // JSON_Error for a value that does not fit its column.
+    static JSON_Columns parse(std::string_view input, const std::vector<std::pair<std::string, Kind>>& shape);
+
+    // nullptr, or throws std::out_of_range, for a missing column
+    const Column *find(std::string_view name) const;
+    const Column& operator[](std::string_view name) const;
+
+    size_t rows = 0;
+    std::vector<Column> columns;
+};
+
+// Reader events of an array of records, appended to a JSON_Columns
+struct JSON_Column_Builder : JSON_Handler
+{
+    JSON_Column_Builder(JSON_Columns& table, bool infer) : table(table), infer(infer)
+    {
+        for (const JSON_Columns::Column& column : table.columns)
+        {
+            hashes.push_back(JSON_Object::hash(column.name));
+        }
+    }
+
+    bool on_null() { return scalar(JSON_Columns::Kind::NIL, [](JSON_Columns::Column&) {}); }
+
+    bool on_bool(bool boolean)
+    {
+        return scalar(JSON_Columns::Kind::BOOLEAN, [&](JSON_Columns::Column& column) {
+            column.booleans.push_back(boolean);
+        });
+    }
+
+    bool on_int64(int64_t number)
+    {
+        return scalar(JSON_Columns::Kind::INT64, [&](JSON_Columns::Column& column) {
+            if (column.kind == JSON_Columns::Kind::INT64)
+            {
+                column.int64s.push_back(number);
+            }
+            else
+            {
+                column.doubles.push_back(static_cast<double>(number));
+            }
+        });
+    }
+
+    bool on_uint64(uint64_t number)
+    {
+        // Only reached for values above INT64_MAX
+        return on_number(static_cast<double>(number));
+    }
+
+    bool on_number(double number)
+    {
+        return scalar(JSON_Columns::Kind::DOUBLE, [&](JSON_Columns::Column& column) {
+            column.doubles.push_back(number);
+        });
+    }
+
+    bool on_string(std::string_view str, bool)
+    {
+        return scalar(JSON_Columns::Kind::STRING, [&](JSON_Columns::Column& column) {
+            column.bytes.append(str);
+            column.ends.push_back(column.bytes.size());
+        });
+    }
+
+    bool on_key(std::string_view key, bool)
+    {
+        if (skip_depth == 0)
+        {
+            current = lookup(key);
+        }
+        return true;
+    }
+
+    bool on_array_begin()
+    {
+        if (skip_depth > 0)
+        {
+            skip_depth++;
+            return true;
+        }
+        if (depth == 0)
+        {
+            depth = 1;
+            return true;
+        }
+        return nested();
+    }
+
+    bool on_array_end()
+    {
+        if (skip_depth > 0)
+        {
+            skip_depth--;
+        }
+        else
+        {
+            depth--;
+        }
+        return true;
+    }
+
+    bool on_object_begin()
+    {
+        if (skip_depth > 0)
+        {
+            skip_depth++;
+            return true;
+        }
+        if (depth != 1)
+        {
+            return depth == 0 ? fail("expected an array of objects") : nested();
+        }
+        depth = 2;
+        table.rows++;
+        return true;
+    }
+
+    bool on_object_end()
+    {
+        if (skip_depth > 0)
+        {
+            skip_depth--;
+            return true;
+        }
+        for (JSON_Columns::Column& column : table.columns)
+        {
+            pad(column, table.rows);
+        }
+        depth = 1;
+        current = none;
+        return true;
+    }
+
+    const char *error = nullptr; // set when the parse was stopped
+
+private:
+    static constexpr size_t none = static_cast<size_t>(-1);
+
+    bool fail(const char *what)
+    {
+        error = what;
+        return false;
+    }
+
+    // A container where a record's value should be: skipped in fields
+    // outside the shape, refused otherwise
+    bool nested()
+    {
+        if (depth == 2 && current == none && !infer)
+        {
+            skip_depth = 1;
+            return true;
+        }
+        return fail(depth == 2 ? "nested value in a columnar record" : "expected an array of objects");
+    }
+
+    // Column of key, created when inferring; none to skip the value. Records
+    // mostly repeat their keys in the same order, so the column after the
+    // last one is tried first.
+    size_t lookup(std::string_view key)
+    {
+        size_t hash = JSON_Object::hash(key);
+        size_t count = table.columns.size();
+        size_t guess = current == none ? 0 : current + 1;
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t index = (guess + i) % count;
+            if (hashes[index] == hash && table.columns[index].name == key)
+            {
+                return index;
+            }
+        }
+        if (!infer)
+        {
+            return none;
+        }
+        JSON_Columns::Column& column = table.columns.emplace_back();
+        column.name = key;
+        hashes.push_back(hash);
+        pad(column, table.rows - 1);
+        return count;
+    }
+
+    // Sizes the storage of the column's kind to its present cells
+    static void fill(JSON_Columns::Column& column)
+    {
+        size_t size = column.size();
+        switch (column.kind)
+        {
+            case JSON_Columns::Kind::BOOLEAN:
+                column.booleans.resize(size, 0);
+                break;
+            case JSON_Columns::Kind::INT64:
+                column.int64s.resize(size, 0);
+                break;
+            case JSON_Columns::Kind::DOUBLE:
+                column.doubles.resize(size, 0.0);
+                break;
+            case JSON_Columns::Kind::STRING:
+                column.ends.resize(size, column.bytes.size());
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Fills the column with absent cells up to size rows
+    static void pad(JSON_Columns::Column& column, size_t size)
+    {
+        if (column.size() < size)
+        {
+            column.present.resize(size, 0);
+            fill(column);
+        }
+    }
+
+    // Drops the last cell, for a key repeated within a record
+    static void drop_last(JSON_Columns::Column& column)
+    {
+        column.present.pop_back();
+        switch (column.kind)
+        {
+            case JSON_Columns::Kind::BOOLEAN:
+                column.booleans.pop_back();
+                break;
+            case JSON_Columns::Kind::INT64:
+                column.int64s.pop_back();
+                break;
+            case JSON_Columns::Kind::DOUBLE:
+                column.doubles.pop_back();
+                break;
+            case JSON_Columns::Kind::STRING:
+                column.ends.pop_back();
+                column.bytes.resize(column.ends.empty() ? 0 : column.ends.back());
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Whether a value of kind can go into column, changing the column's kind
+    // where inference allows
+    bool admit(JSON_Columns::Column& column, JSON_Columns::Kind kind)
+    {
+        using Kind = JSON_Columns::Kind;
+        if (kind == Kind::NIL || kind == column.kind || (kind == Kind::INT64 && column.kind == Kind::DOUBLE))
+        {
+            return true;
+        }
+        if (!infer)
+        {
+            return false;
+        }
+        if (column.kind == Kind::NIL)
+        {
+            column.kind = kind;
+            fill(column);
+            return true;
+        }
+        if (kind == Kind::DOUBLE && column.kind == Kind::INT64)
+        {
+            column.doubles.assign(column.int64s.begin(), column.int64s.end());
+            column.int64s = {};
+            column.kind = Kind::DOUBLE;
+            return true;
+        }
+        return false;
+    }
+
+    template <typename Append>
+    bool scalar(JSON_Columns::Kind kind, Append append)
+    {
+        if (skip_depth > 0)
+        {
+            return true;
+        }
+        if (depth != 2)
+        {
+            return fail("expected an array of objects");
+        }
+        if (current == none)
+        {
+            return true;
+        }
+        JSON_Columns::Column& column = table.columns[current];
+        if (!admit(column, kind))
+        {
+            return fail(infer ? "field changes kind between records" : "value does not fit its column");
+        }
+        if (column.size() == table.rows)
+        {
+            drop_last(column);
+        }
+        pad(column, table.rows - 1);
+        if (kind == JSON_Columns::Kind::NIL)
+        {
+            pad(column, table.rows);
+        }
+        else
+        {
+            column.present.push_back(1);
+            append(column);
+        }
+        return true;
+    }
+
+    JSON_Columns& table;
+    bool infer;
+    std::vector<size_t> hashes; // of the column names
+    size_t depth = 0;           // 1 inside the array, 2 inside a record
+    size_t skip_depth = 0;      // open containers inside a skipped field
+    size_t current = none;      // column of the last key
+};
+
+static JSON_Columns json_columns_parse(std::string_view input, JSON_Columns table, bool infer)
+{
+    JSON_Column_Builder builder(table, infer);
+    JSON_Reader<JSON_Column_Builder> reader(builder);
+    if (!reader.feed(input) || !reader.finish())
+    {
+        throw JSON_Error(builder.error, reader.offset());
+    }
+    return table;
+}
+
+JSON_Columns JSON_Columns::parse(std::string_view input)
+{
+    return json_columns_parse(input, {}, true);
+}
+
+JSON_Columns JSON_Columns::parse(std::string_view input, const std::vector<std::pair<std::string, Kind>>& shape)
+{
+    JSON_Columns table;
+    for (const auto& [name, kind] : shape)
+    {
+        assert(kind != Kind::NIL);
+        Column& column = table.columns.emplace_back();
+        column.name = name;
+        column.kind = kind;
+    }
+    return json_columns_parse(input, std::move(table), false);
+}
+
+const JSON_Columns::Column *JSON_Columns::find(std::string_view name) const
+{
+    for (const Column& column : columns)
+    {
+        if (column.name == name)
+        {
+            return &column;
+        }
+    }
+    return nullptr;
+}
+
+const JSON_Columns::Column& JSON_Columns::operator[](std::string_view name) const
+{
+    const Column *column = find(name);
+    if (column == nullptr)
+    {
+        throw std::out_of_range("JSON_Columns::operator[]");
+    }
+    return *column;
+}
+
+// Appends a CBOR item head: the major type and its argument in the shortest form
+template <typename Buffer>
+static void json_cbor_head(Buffer& out, unsigned major, uint64_t argument)
+{
+    unsigned char head[9];
+    size_t size = argument < 24 ? 0 : argument <= UINT8_MAX ? 1 : argument <= UINT16_MAX ? 2 : argument <= UINT32_MAX ? 4 : 8;
+    head[0] = static_cast<unsigned char>(major << 5 | (size == 0 ? argument : 23 + std::bit_width(size)));
+    for (size_t i = 0; i < size; i++)
+    {
+        head[size - i] = static_cast<unsigned char>(argument >> (8 * i));
+    }
+    out.append(reinterpret_cast<const char*>(head), size + 1);
+}
+
+template <typename Buffer>
+void JSON_Value::write_cbor(Buffer& out) const
+{
+    struct Writer
+    {
+        Buffer& out;
+
+        bool scalar(const JSON_Value& value)
+        {
+            switch (value.type())
+            {
+                case JSON_Type::BOOLEAN:
+                    out.push_back(value.boolean() ? '\xf5' : '\xf4');
+                    break;
+                case JSON_Type::NUMBER:
+                    if (const int64_t *integer = std::get_if<int64_t>(&value.value))
+                    {
+                        // Negative integers are stored as -1 - n
+                        if (*integer < 0)
+                        {
+                            json_cbor_head(out, 1, ~static_cast<uint64_t>(*integer));
+                        }
+                        else
+                        {
+                            json_cbor_head(out, 0, static_cast<uint64_t>(*integer));
+                        }
+                    }
+                    else if (const uint64_t *integer = std::get_if<uint64_t>(&value.value))
+                    {
+                        json_cbor_head(out, 0, *integer);
+                    }
+                    else
+                    {
+                        // Single precision when that loses nothing
+                        double number = std::get<double>(value.value);
+                        float single = static_cast<float>(number);
+                        if (single == number)
+                        {
+                            out.push_back('\xfa');
+                            uint32_t bits = std::bit_cast<uint32_t>(single);
+                            for (int shift = 24; shift >= 0; shift -= 8)
+                            {
+                                out.push_back(static_cast<char>(bits >> shift));
+                            }
+                        }
+                        else
+                        {
+                            out.push_back('\xfb');
+                            uint64_t bits = std::bit_cast<uint64_t>(number);
+                            for (int shift = 56; shift >= 0; shift -= 8)
+                            {
+                                out.push_back(static_cast<char>(bits >> shift));
+                            }
+                        }
+                    }
+                    break;
+                case JSON_Type::STRING: {
+                    std::string_view str = value.string_view();
+                    json_cbor_head(out, 3, str.size());
+                    out.append(str.data(), str.size());
+                    break;
+                }
+                default:
+                    out.push_back('\xf6');
+                    break;
+            }
+            return true;
+        }
+
+        bool open(const JSON_Value& container)
+        {
+            if (container.type() == JSON_Type::ARRAY)
+            {
+                json_cbor_head(out, 4, container.array().size());
+            }
+            else
+            {
+                json_cbor_head(out, 5, container.object().size());
+            }
+            return true;
+        }
+
+        bool close(const JSON_Value&)
+        {
+            return true;
+        }
+
+        const JSON_Value *child(const JSON_Value& container, size_t position)
+        {
+            if (container.type() == JSON_Type::ARRAY)
+            {
+                return &container.array()[position];
+            }
+            const auto& [key, member] = container.object().begin()[position];
+            std::string_view name = key;
+            json_cbor_head(out, 3, name.size());
+            out.append(name.data(), name.size());
+            return &member;
+        }
+    };
+    Writer writer{out};
+    json_walk(*this, writer);
+}
+
+// Recursive descent over one CBOR item, as deep as max_depth allows
+struct JSON_Cbor_Decoder
+{
+    const unsigned char *begin;
+    const unsigned char *p;
+    const unsigned char *end;
+    std::pmr::memory_resource *resource;
+    size_t max_depth;
+    size_t depth = 0; // items enclosing the current one
+
+    [[noreturn]] void fail(const char *what) const
+    {
+        throw JSON_Error(what, p - begin);
+    }
+
+    void need(uint64_t size) const
+    {
+        if (static_cast<uint64_t>(end - p) < size)
+        {
+            fail("unexpected end of CBOR data");
+        }
+    }
+
+    uint64_t read_be(size_t size)
+    {
+        need(size);
+        uint64_t value = 0;
+        for (size_t i = 0; i < size; i++)
+        {
+            value = value << 8 | *p++;
+        }
+        return value;
+    }
+
+    // Argument of a head with additional information info; 31 is handled by
+    // the callers that allow indefinite lengths
+    uint64_t argument(unsigned info)
+    {
+        if (info < 24)
+        {
+            return info;
+        }
+        if (info > 27)
+        {
+            fail("invalid CBOR additional information");
+        }
+        return read_be(size_t(1) << (info - 24));
+    }
+
+    // Consumes the break that ends an indefinite-length item, if it is next
+    bool at_break()
+    {
+        need(1);
+        if (*p == 0xff)
+        {
+            p++;
+            return true;
+        }
+        return false;
+    }
+
+    // Consumes the head of a text string and returns its additional information
+    unsigned text_head()
+    {
+        need(1);
+        unsigned major = *p >> 5, info = *p & 31;
+        if (major != 3)
+        {
+            fail("expected a CBOR text string");
+        }
+        p++;
+        return info;
+    }
+
+    void text_chunk(JSON_String& out, unsigned info)
+    {
+        uint64_t size = argument(info);
+        need(size);
+        out.append(reinterpret_cast<const char*>(p), size);
+        p += size;
+    }
+
+    void text(JSON_String& out)
+    {
+        unsigned info = text_head();
+        if (info != 31)
+        {
+            text_chunk(out, info);
+            return;
+        }
+        // The chunks of an indefinite-length string must have definite lengths
+        while (!at_break())
+        {
+            info = text_head();
+            if (info == 31)
+            {
+                p--;
+                fail("nested indefinite CBOR text string");
+            }
+            text_chunk(out, info);
+        }
+    }
+
+    static double half(uint16_t bits)
+    {
+        int exponent = (bits >> 10) & 0x1f;
+        double mantissa = bits & 0x3ff;
+        double magnitude = exponent == 0 ? std::ldexp(mantissa, -24)
+                         : exponent == 31 ? (mantissa == 0 ? INFINITY : NAN)
+                         : std::ldexp(mantissa + 1024, exponent - 25);
+        return bits & 0x8000 ? -magnitude : magnitude;
+    }
+
+    JSON_Value item()
+    {
+        if (depth > max_depth)
+        {
+            fail("CBOR data nested too deeply");
+        }
+        depth++;
+        JSON_Value value = read_item();
+        depth--;
+        return value;
+    }
+
+    JSON_Value read_item()
+    {
+        need(1);
+        unsigned major = *p >> 5, info = *p & 31;
+        switch (major)
+        {
+            case 0: {
+                p++;
+                uint64_t integer = argument(info);
+                return integer <= INT64_MAX ? JSON_Value(static_cast<int64_t>(integer)) : JSON_Value(integer);
+            }
+            case 1: {
+                p++;
+                uint64_t n = argument(info);
+                return n <= INT64_MAX ? JSON_Value(-1 - static_cast<int64_t>(n)) : JSON_Value(-1.0 - static_cast<double>(n));
+            }
+            case 2:
+                fail("CBOR byte strings have no JSON equivalent");
+            case 3: {
+                JSON_String str(resource);
+                text(str);
+                return JSON_Value(std::move(str));
+            }
+            case 4: {
+                p++;
+                JSON_Array array(resource);
+                if (info == 31)
+                {
+                    while (!at_break())
+                    {
+                        array.push_back(item());
+                    }
+                }
+                else
+                {
+                    // Every element takes at least a byte, which bounds a bogus length
+                    uint64_t size = argument(info);
+                    array.reserve(std::min<uint64_t>(size, end - p));
+                    for (uint64_t i = 0; i < size; i++)
+                    {
+                        array.push_back(item());
+                    }
+                }
+                return JSON_Value(std::move(array));
+            }
+            case 5: {
+                p++;
+                JSON_Object object(resource);
+                JSON_String key(resource);
+                auto member = [&] {
+                    key.clear();
+                    text(key);
+                    object.insert_or_assign(key, item());
+                };
+                if (info == 31)
+                {
+                    while (!at_break())
+                    {
+                        member();
+                    }
+                }
+                else
+                {
+                    uint64_t size = argument(info);
+                    object.reserve(std::min<uint64_t>(size, (end - p) / 2));
+                    for (uint64_t i = 0; i < size; i++)
+                    {
+                        member();
+                    }
+                }
+                return JSON_Value(std::move(object));
+            }
+            case 6:
+                // Tags carry no meaning JSON can keep
+                p++;
+                argument(info);
+                return item();
+            default:
+                p++;
+                switch (info)
+                {
+                    case 20:
+                        return JSON_Value(false);
+                    case 21:
+                        return JSON_Value(true);
+                    case 22:
+                    case 23: // undefined
+                        return JSON_Value();
+                    case 25:
+                        return JSON_Value(half(static_cast<uint16_t>(read_be(2))));
+                    case 26:
+                        return JSON_Value(std::bit_cast<float>(static_cast<uint32_t>(read_be(4))));
+                    case 27:
+                        return JSON_Value(std::bit_cast<double>(read_be(8)));
+                    default:
+                        p--;
+                        fail("unsupported CBOR simple value");
+                }
+        }
+    }
+};
+
+inline JSON_Value JSON_Value::from_cbor(std::string_view data, std::pmr::memory_resource *resource)
+{
+    return from_cbor(data, JSON_Parse_Options{}, resource);
+}
+
+inline JSON_Value JSON_Value::from_cbor(std::string_view data, const JSON_Parse_Options& options,
+                                        std::pmr::memory_resource *resource)
+{
+    if (data.size() > options.max_size)
+    {
+        throw JSON_Error("document exceeds the size limit", options.max_size);
+    }
+    const unsigned char *begin = reinterpret_cast<const unsigned char*>(data.data());
+    JSON_Cbor_Decoder decoder{begin, begin, begin + data.size(), resource, options.max_depth};
+    JSON_Value value = decoder.item();
+    if (decoder.p != decoder.end)
+    {
+        decoder.fail("trailing data after CBOR item");
+    }
+    return value;
+}
+
+// Splits a tree into text written up front and runs of container children
+// left to the workers of JSON_Value::write_parallel. Containers narrower than
+// width are descended into so that a wide one deeper down still gets split.
+struct JSON_Write_Plan
+{
+    struct Run
+    {
+        size_t piece;
+        const JSON_Value *elements; // arrays
+        JSON_Object::const_iterator members; // objects
+        size_t count;
+    };
+
+    // Containers deeper than this are written whole rather than descended into
+    static constexpr size_t max_depth = 64;
+
+    JSON_Write_Plan(std::vector<std::string>& pieces, size_t width) : pieces(pieces), width(width) {}
+
+    void plan(const JSON_Value& value, size_t depth = 0)
+    {
+        if (depth == max_depth)
+        {
+            value.write(pieces.back());
+        }
+        else if (value.type() == JSON_Type::ARRAY)
+        {
+            const JSON_Array& array = value.array();
+            pieces.back().push_back('[');
+            if (array.size() >= width)
+            {
+                split(array.size(), [&](size_t first, size_t count) {
+                    return Run{0, array.data() + first, {}, count};
+                });
+            }
+            else
+            {
+                for (size_t i = 0; i < array.size(); i++)
+                {
+                    if (i > 0)
+                    {
+                        pieces.back().push_back(',');
+                    }
+                    plan(array[i], depth + 1);
+                }
+            }
+            pieces.back().push_back(']');
+        }
+        else if (value.type() == JSON_Type::OBJECT)
+        {
+            const JSON_Object& object = value.object();
+            pieces.back().push_back('{');
+            if (object.size() >= width)
+            {
+                split(object.size(), [&](size_t first, size_t count) {
+                    return Run{0, nullptr, object.begin() + first, count};
+                });
+            }
+            else
+            {
+                bool first = true;
+                for (const auto& [k, v] : object)
+                {
+                    if (!first)
+                    {
+                        pieces.back().push_back(',');
+                    }
+                    first = false;
+                    json_write_string(pieces.back(), k);
+                    pieces.back().push_back(':');
+                    plan(v, depth + 1);
+                }
+            }
+            pieces.back().push_back('}');
+        }
+        else
+        {
+            value.write(pieces.back());
+        }
+    }
+
+    void write(const Run& run) const
+    {
+        std::string& out = pieces[run.piece];
+        for (size_t i = 0; i < run.count; i++)
+        {
+            if (i > 0)
+            {
+                out.push_back(',');
+            }
+            if (run.elements)
+            {
+                run.elements[i].write(out);
+            }
+            else
+            {
+                const auto& [k, v] = run.members[i];
+                json_write_string(out, k);
+                out.push_back(':');
+                v.write(out);
+            }
+        }
+    }
+
+    std::vector<std::string>& pieces;
+    std::vector<Run> runs;
+    size_t width;
+
+private:
+    // width runs of about equal length, each in a piece of its own
+    template <typename Make>
+    void split(size_t size, Make make)
+    {
+        size_t length = (size + width - 1) / width;
+        for (size_t first = 0; first < size; first += length)
+        {
+            if (first > 0)
+            {
+                pieces.back().push_back(',');
+            }
+            runs.push_back(make(first, std::min(length, size - first)));
+            runs.back().piece = pieces.size();
+            pieces.emplace_back();
+            pieces.emplace_back();
+        }
+    }
+};
+
+inline void JSON_Value::write_parallel(std::vector<std::string>& pieces, unsigned threads) const
+{
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    pieces.assign(1, std::string());
+    // A few runs per thread even out children of different sizes
+    JSON_Write_Plan plan(pieces, threads * 4);
+    plan.plan(*this);
+
+    std::atomic<size_t> next{0};
+    std::vector<std::exception_ptr> errors(threads);
+    auto work = [&](size_t worker) {
+        try
+        {
+            for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < plan.runs.size();)
+            {
+                plan.write(plan.runs[i]);
+            }
+        }
+        catch (...)
+        {
+            errors[worker] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < std::min<size_t>(threads, plan.runs.size()); i++)
+    {
+        workers.emplace_back(work, i);
+    }
+    work(0);
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    for (const std::exception_ptr& error : errors)
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+inline std::string JSON_Value::to_string_parallel(unsigned threads) const
+{
+    std::vector<std::string> pieces;
+    write_parallel(pieces, threads);
+    size_t size = 0;
+    for (const std::string& piece : pieces)
+    {
+        size += piece.size();
+    }
+    std::string out;
+    out.reserve(size);
+    for (const std::string& piece : pieces)
+    {
+        out += piece;
+    }
+    return out;
+}
+
+#if defined(JSON_HAS_MMAP)
+inline void JSON_Value::write_parallel(int fd, unsigned threads) const
+{
+#if defined(IOV_MAX)
+    constexpr size_t batch = IOV_MAX;
+#else
+    constexpr size_t batch = 16;
+#endif
+    std::vector<std::string> pieces;
+    write_parallel(pieces, threads);
+    std::vector<iovec> iov;
+    for (std::string& piece : pieces)
+    {
+        if (!piece.empty())
+        {
+            iov.push_back({piece.data(), piece.size()});
+        }
+    }
+    for (size_t first = 0; first < iov.size();)
+    {
+        ssize_t written = ::writev(fd, &iov[first], static_cast<int>(std::min(batch, iov.size() - first)));
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "writev");
+        }
+        // Skip what was written, which may end inside a piece
+        for (size_t left = written; left > 0;)
+        {
+            size_t step = std::min(left, iov[first].iov_len);
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + step;
+            iov[first].iov_len -= step;
+            left -= step;
+            if (iov[first].iov_len == 0)
+            {
+                first++;
+            }
+        }
+    }
+}
+#endif
+
+template <typename Buffer>
+void JSON_Value::write(Buffer& out, const JSON_Write_Options& options) const
+{
+    if (options.indent == 0 && !options.sort_keys)
+    {
+        write(out);
+        return;
+    }
+
+    struct Writer
+    {
+        Buffer& out;
+        const JSON_Write_Options& options;
+        size_t depth = 0;
+        // Member order of each open object when sorting; sorting orders
+        // pointers to the members, the objects are untouched
+        std::vector<std::vector<const JSON_Object::value_type*>> orders;
+
+        void newline()
+        {
+            if (options.indent > 0)
+            {
+                out.push_back('\n');
+                for (size_t i = 0; i < depth * options.indent; i++)
+                {
+                    out.push_back(' ');
+                }
+            }
+        }
+
+        bool scalar(const JSON_Value& value)
+        {
+            json_write_scalar(out, value);
+            return true;
+        }
+
+        bool open(const JSON_Value& container)
+        {
+            depth++;
+            if (container.type() == JSON_Type::ARRAY)
+            {
+                out.push_back('[');
+                return true;
+            }
+            out.push_back('{');
+            if (options.sort_keys)
+            {
+                std::vector<const JSON_Object::value_type*>& members = orders.emplace_back();
+                members.reserve(container.object().size());
+                for (const auto& member : container.object())
+                {
+                    members.push_back(&member);
+                }
+                std::sort(members.begin(), members.end(), [](const auto *a, const auto *b) {
+                    return std::string_view(a->first) < std::string_view(b->first);
+                });
+            }
+            return true;
+        }
+
+        bool close(const JSON_Value& container)
+        {
+            depth--;
+            bool array = container.type() == JSON_Type::ARRAY;
+            if (array ? !container.array().empty() : !container.object().empty())
+            {
+                newline();
+            }
+            if (!array && options.sort_keys)
+            {
+                orders.pop_back();
+            }
+            out.push_back(array ? ']' : '}');
+            return true;
+        }
+
+        const JSON_Value *child(const JSON_Value& container, size_t position)
+        {
+            if (position > 0)
+            {
+                out.push_back(',');
+            }
+            newline();
+            if (container.type() == JSON_Type::ARRAY)
+            {
+                return &container.array()[position];
+            }
+            const JSON_Object::value_type& member =
+                options.sort_keys ? *orders.back()[position] : container.object().begin()[position];
+            json_write_string(out, member.first);
+            out.push_back(':');
+            if (options.indent > 0)
+            {
+                out.push_back(' ');
+            }
+            return &member.second;
+        }
+    };
+    Writer writer{out, options, 0, {}};
+    json_walk(*this, writer);
+}
+
+// Buffer for JSON_Value::write that holds at most capacity bytes and hands
+// them to sink(const char*, size_t) whenever it fills up. Call flush() after
+// the last write.
+template <typename Sink>
+struct JSON_Stream_Buffer
+{
+    static constexpr size_t capacity = 64 * 1024;
+
+    explicit JSON_Stream_Buffer(Sink sink) : sink(sink), data(new char[capacity]) {}
+
+    void push_back(char c)
+    {
+        if (size == capacity)
+        {
+            flush();
+        }
+        data[size++] = c;
+    }
+
+    void append(const char *str, size_t length)
+    {
+        if (length > capacity - size)
+        {
+            flush();
+            // Long runs go to the sink directly
+            if (length >= capacity)
+            {
+                sink(str, length);
+                return;
+            }
+        }
+        std::memcpy(data.get() + size, str, length);
+        size += length;
+    }
+
+    void flush()
+    {
+        if (size > 0)
+        {
+            sink(data.get(), size);
+            size = 0;
+        }
+    }
+
+private:
+    Sink sink;
+    std::unique_ptr<char[]> data;
+    size_t size = 0;
+};
+
+template <typename Sink>
+static void json_write_stream(const JSON_Value& value, const JSON_Write_Options& options, Sink sink)
+{
+    JSON_Stream_Buffer<Sink> buffer(sink);
+    value.write(buffer, options);
+    buffer.flush();
+}
+
+#if defined(JSON_HAS_MMAP)
+inline void JSON_Value::write_to(int fd, const JSON_Write_Options& options) const
+{
+    json_write_stream(*this, options, [fd](const char *data, size_t size) {
+        while (size > 0)
+        {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(), "write");
+            }
+            data += written;
+            size -= written;
+        }
+    });
+}
+#endif
+
+inline void JSON_Value::write_to(FILE *file, const JSON_Write_Options& options) const
+{
+    json_write_stream(*this, options, [file](const char *data, size_t size) {
+        if (std::fwrite(data, 1, size, file) != size)
+        {
+            throw std::system_error(errno, std::generic_category(), "fwrite");
+        }
+    });
+}
+
+inline void JSON_Value::write_to(std::ostream& stream, const JSON_Write_Options& options) const
+{
+    json_write_stream(*this, options, [&stream](const char *data, size_t size) {
+        stream.write(data, size);
+    });
+}
+
+#if defined(JSON_BENCHMARK)
+// Benchmark build:
+//   g++ -std=c++20 -O2 -DJSON_BENCHMARK json.cpp -o json_bench
+//   ./json_bench twitter.json canada.json citm_catalog.json logs.ndjson
+// prints one JSON object per line for each corpus and benchmark, so runs of
+// two releases can be diffed. Files ending in .ndjson or .jsonl are parsed as
+// newline-delimited JSON. Without arguments synthetic corpora are generated.
+
+// Every global allocation is counted, including the aligned ones that the
+// default memory resource makes
+static std::atomic<uint64_t> json_bench_allocations{0};
+
+static void *json_bench_allocate(size_t size, size_t alignment)
+{
+    json_bench_allocations.fetch_add(1, std::memory_order_relaxed);
+    size = (std::max<size_t>(size, 1) + alignment - 1) / alignment * alignment;
+    if (void *p = std::aligned_alloc(alignment, size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size)
+{
+    return json_bench_allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    return json_bench_allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+// Results are stored here so the measured work cannot be optimized away
+static volatile size_t json_bench_sink;
+
+struct JSON_Bench_Result
+{
+    uint64_t iterations = 0;
+    double seconds = 0;
+    uint64_t allocations = 0;
+};
+
+// Runs body once to warm up, then repeatedly for at least half a second
+template <typename Body>
+static JSON_Bench_Result json_bench_run(Body body)
+{
+    using Clock = std::chrono::steady_clock;
+    body();
+    JSON_Bench_Result result;
+    uint64_t allocations = json_bench_allocations.load(std::memory_order_relaxed);
+    Clock::time_point start = Clock::now();
+    do
+    {
+        body();
+        result.iterations++;
+        result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (result.seconds < 0.5);
+    result.allocations = json_bench_allocations.load(std::memory_order_relaxed) - allocations;
+    return result;
+}
+
+// Kilobytes, or 0 where getrusage is unavailable
+static uint64_t json_bench_peak_rss()
+{
+#if defined(JSON_HAS_MMAP)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return static_cast<uint64_t>(usage.ru_maxrss) / 1024;
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#endif
+#else
+    return 0;
+#endif
+}
+
+static void json_bench_report(std::string_view corpus, const char *benchmark, size_t bytes,
+                              const JSON_Bench_Result& result)
+{
+    JSON_Object line;
+    line["corpus"] = JSON_String(corpus);
+    line["benchmark"] = benchmark;
+    line["bytes"] = static_cast<uint64_t>(bytes);
+    line["iterations"] = result.iterations;
+    line["seconds"] = result.seconds;
+    line["mb_per_s"] = static_cast<double>(bytes) * result.iterations / result.seconds / 1e6;
+    line["allocations_per_iteration"] = static_cast<double>(result.allocations) / result.iterations;
+    line["peak_rss_kb"] = json_bench_peak_rss();
+    std::cout << JSON_Value(std::move(line)).to_string() << std::endl;
+}
+
+// Looks up every key of every object in its own object
+static size_t json_bench_lookup(const JSON_Value& value)
+{
+    size_t found = 0;
+    if (value.type() == JSON_Type::OBJECT)
+    {
+        for (const auto& [key, member] : value.object())
+        {
+            found += value.object().contains(key);
+            found += json_bench_lookup(member);
+        }
+    }
+    else if (value.type() == JSON_Type::ARRAY)
+    {
+        for (const JSON_Value& element : value.array())
+        {
+            found += json_bench_lookup(element);
+        }
+    }
+    return found;
+}
+
+// Adds and removes a member in every object
+static void json_bench_mutate(JSON_Value& value)
+{
+    if (value.type() == JSON_Type::OBJECT)
+    {
+        for (auto& [key, member] : value.object())
+        {
+            json_bench_mutate(member);
+        }
+        value.object().insert_or_assign("__bench", JSON_Value(1));
+        value.object().erase("__bench");
+    }
+    else if (value.type() == JSON_Type::ARRAY)
+    {
+        for (JSON_Value& element : value.array())
+        {
+            json_bench_mutate(element);
+        }
+    }
+}
+
+static void json_bench_document(std::string_view corpus, std::string_view text)
+{
+    size_t sink = 0;
+    json_bench_report(corpus, "parse", text.size(), json_bench_run([&] {
+        sink += JSON_Parser::parse(text).type() == JSON_Type::NIL;
+    }));
+    json_bench_report(corpus, "parse_arena", text.size(), json_bench_run([&] {
+        JSON_Document document(text);
+        sink += document.root().type() == JSON_Type::NIL;
+    }));
+    json_bench_report(corpus, "parse_tape", text.size(), json_bench_run([&] {
+        sink += JSON_Tape(text).entries.size();
+    }));
+
+#if defined(JSON_STATS)
+    // One instrumented parse shows where the parse time goes
+    JSON_Parse_Stats stats;
+    JSON_Stats_Resource counted(stats);
+    JSON_Parse_Options options;
+    options.stats = &stats;
+    sink += JSON_Parser::parse(text, options, &counted).type() == JSON_Type::NIL;
+    JSON_Value line = stats.to_value();
+    line.emplace("corpus", JSON_String(corpus));
+    line.emplace("benchmark", "parse_stats");
+    std::cout << line.to_string() << std::endl;
+#endif
+
+    JSON_Value tree = JSON_Parser::parse(text);
+    std::string out;
+    json_bench_report(corpus, "serialize", text.size(), json_bench_run([&] {
+        out.clear();
+        tree.write(out);
+    }));
+    std::vector<std::string> pieces;
+    json_bench_report(corpus, "serialize_parallel", text.size(), json_bench_run([&] {
+        tree.write_parallel(pieces);
+    }));
+    json_bench_report(corpus, "lookup", text.size(), json_bench_run([&] {
+        sink += json_bench_lookup(tree);
+    }));
+    json_bench_report(corpus, "mutate", text.size(), json_bench_run([&] {
+        JSON_Value copy = tree;
+        json_bench_mutate(copy);
+    }));
+    json_bench_sink = sink;
+}
+
+static void json_bench_lines(std::string_view corpus, std::string_view text)
+{
+    size_t sink = 0;
+    json_bench_report(corpus, "parse_lines", text.size(), json_bench_run([&] {
+        sink += JSON_Parser::parse_lines(text).size();
+    }));
+    json_bench_report(corpus, "parse_lines_1", text.size(), json_bench_run([&] {
+        sink += JSON_Parser::parse_lines(text, 1).size();
+    }));
+    // One message at a time, as a service handling requests would
+    JSON_Reusable_Parser parser;
+    json_bench_report(corpus, "parse_messages_arena", text.size(), json_bench_run([&] {
+        for (size_t line = 0; line < text.size();)
+        {
+            size_t next = json_line_boundary(text, line);
+            std::string_view message = text.substr(line, next - line);
+            if (message.find_first_not_of(" \t\r\n") != std::string_view::npos)
+            {
+                sink += parser.parse_in_arena(message).type() == JSON_Type::NIL;
+            }
+            line = next;
+        }
+    }));
+    json_bench_sink = sink;
+}
+
+// Synthetic stand-ins for the standard corpora, generated deterministically
+static std::string json_bench_records(size_t count)
+{
+    uint64_t state = 1;
+    auto next = [&] { return state = state * 6364136223846793005 + 1442695040888963407, state >> 33; };
+    JSON_Array records;
+    records.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        JSON_Object user{{"id", JSON_Value(static_cast<int64_t>(next()))},
+                         {"screen_name", JSON_Value("user_" + std::to_string(next() % 10000))},
+                         {"followers_count", JSON_Value(static_cast<int64_t>(next() % 100000))},
+                         {"verified", JSON_Value(next() % 2 == 0)}};
+        JSON_Array tags;
+        for (uint64_t t = next() % 4; t > 0; t--)
+        {
+            tags.emplace_back("tag" + std::to_string(next() % 100));
+        }
+        records.emplace_back(JSON_Object{{"id", JSON_Value(static_cast<int64_t>(i))},
+                                         {"text", JSON_Value("Status text number " + std::to_string(next()) + " with \"quotes\"\n")},
+                                         {"created_at", JSON_Value("Sun Aug 31 00:29:15 +0000 2014")},
+                                         {"user", JSON_Value(std::move(user))},
+                                         {"retweet_count", JSON_Value(static_cast<int64_t>(next() % 1000))},
+                                         {"tags", JSON_Value(std::move(tags))},
+                                         {"reply_to", JSON_Value()}});
+    }
+    return JSON_Value(std::move(records)).to_string();
+}
+
+static std::string json_bench_numbers(size_t count)
+{
+    uint64_t state = 7;
+    auto next = [&] { return state = state * 6364136223846793005 + 1442695040888963407, static_cast<double>(state >> 11) * 0x1p-53; };
+    JSON_Array points;
+    points.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        points.emplace_back(JSON_Array{JSON_Value(-180 + 360 * next()), JSON_Value(-90 + 180 * next())});
+    }
+    return JSON_Value(JSON_Object{{"type", JSON_Value("Polygon")}, {"coordinates", JSON_Value(std::move(points))}}).to_string();
+}
+
+static std::string json_bench_logs(size_t count)
+{
+    std::string logs;
+    for (size_t i = 0; i < count; i++)
+    {
+        JSON_Value line(JSON_Object{{"ts", JSON_Value(static_cast<int64_t>(1700000000000 + i))},
+                                    {"level", JSON_Value(i % 10 == 0 ? "warn" : "info")},
+                                    {"msg", JSON_Value("request handled")},
+                                    {"latency_ms", JSON_Value(static_cast<double>(i % 997) / 7)},
+                                    {"path", JSON_Value("/api/v1/items/" + std::to_string(i % 5000))}});
+        line.write(logs);
+        logs.push_back('\n');
+    }
+    return logs;
+}
+
+static std::string json_bench_series(size_t count)
+{
+    JSON_Array series;
+    series.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        series.emplace_back(JSON_Object{{"ts", JSON_Value(static_cast<int64_t>(1700000000000 + i))},
+                                        {"v", JSON_Value(static_cast<double>(i % 997) / 7)},
+                                        {"tag", JSON_Value("sensor_" + std::to_string(i % 64))}});
+    }
+    return JSON_Value(std::move(series)).to_string();
+}
+
+// An array of records decoded as a tree and as columns
+static void json_bench_columns(std::string_view corpus, std::string_view text)
+{
+    size_t sink = 0;
+    json_bench_report(corpus, "parse", text.size(), json_bench_run([&] {
+        sink += JSON_Parser::parse(text).type() == JSON_Type::NIL;
+    }));
+    json_bench_report(corpus, "parse_columns", text.size(), json_bench_run([&] {
+        sink += JSON_Columns::parse(text).rows;
+    }));
+    json_bench_sink = sink;
+}
+
+static bool json_bench_is_lines(std::string_view path)
+{
+    return path.ends_with(".ndjson") || path.ends_with(".jsonl");
+}
+
+static int json_benchmark(int argc, char **argv)
+{
+    try
+    {
+        if (argc < 2)
+        {
+            json_bench_document("synthetic_records", json_bench_records(20000));
+            json_bench_document("synthetic_numbers", json_bench_numbers(100000));
+            json_bench_lines("synthetic_logs.ndjson", json_bench_logs(100000));
+            json_bench_columns("synthetic_series", json_bench_series(100000));
+            return 0;
+        }
+        for (int i = 1; i < argc; i++)
+        {
+            JSON_Mapped_File file(argv[i]);
+            if (json_bench_is_lines(argv[i]))
+            {
+                json_bench_lines(argv[i], file.view());
+            }
+            else
+            {
+                json_bench_document(argv[i], file.view());
+            }
+        }
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr << "benchmark failed: " << error.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    return json_benchmark(argc, argv);
+}
+#elif defined(JSON_SELF_TEST)
+// Self-check build:
+//   g++ -std=c++20 -DJSON_SELF_TEST json.cpp -o json_test && ./json_test
+// runs a short check of every feature and exits with 1 if any of them fails.
+
+static int json_test_failures = 0;
+
+#define JSON_CHECK(condition)                                                               \
+    do                                                                                      \
+    {                                                                                       \
+        if (!(condition))                                                                   \
+        {                                                                                   \
+            json_test_failures++;                                                           \
+            std::cerr << "json.cpp:" << __LINE__ << ": check failed: " #condition << std::endl; \
+        }                                                                                   \
+    } while (0)
+
+// Whether body throws E, and at offset when one is given
+template <typename E = JSON_Error, typename Body>
+static bool json_test_throws(Body body, size_t offset = SIZE_MAX)
+{
+    try
+    {
+        body();
+    }
+    catch (const E& error)
+    {
+        if constexpr (std::is_same_v<E, JSON_Error>)
+        {
+            return offset == SIZE_MAX || error.offset == offset;
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool json_test_rejects(std::string_view text, size_t offset = SIZE_MAX)
+{
+    return json_test_throws([&] { JSON_Parser::parse(text); }, offset);
+}
+
+static std::string json_test_round_trip(std::string_view text)
+{
+    return JSON_Parser::parse(text).to_string();
+}
+
+struct JSON_Test_Point
+{
+    double x = 0;
+    double y = 0;
+};
+JSON_BIND(JSON_Test_Point, x, y);
+
+struct JSON_Test_Record
+{
+    int64_t id = 0;
+    std::string name;
+    std::vector<JSON_Test_Point> path;
+    std::optional<std::string> nick;
+    std::vector<bool> flags;
+    uint8_t level = 0;
+};
+JSON_BIND(JSON_Test_Record, id, name, path, nick, flags, level);
+
+// Reader events as a string, stopping after stop_after events
+struct JSON_Test_Events : JSON_Handler
+{
+    std::string log;
+    int stop_after = -1;
+
+    bool event(std::string_view what)
+    {
+        log += what;
+        return --stop_after != 0;
+    }
+
+    bool on_null() { return event("n"); }
+    bool on_bool(bool boolean) { return event(boolean ? "t" : "f"); }
+    bool on_number(double) { return event("d"); }
+    bool on_int64(int64_t) { return event("i"); }
+    bool on_uint64(uint64_t) { return event("u"); }
+    bool on_string(std::string_view str, bool) { return event("s:" + std::string(str) + ";"); }
+    bool on_key(std::string_view key, bool) { return event("k:" + std::string(key) + ";"); }
+    bool on_object_begin() { return event("{"); }
+    bool on_object_end() { return event("}"); }
+    bool on_array_begin() { return event("["); }
+    bool on_array_end() { return event("]"); }
+};
+
+static void json_test_parse()
+{
+    JSON_CHECK(json_test_round_trip(" [ 1 , -2.5e3, \"a,b:}\" , true , false, null , {}, [] ] ") ==
+               "[1,-2500,\"a,b:}\",true,false,null,{},[]]");
+    JSON_CHECK(json_test_round_trip("{\"a\":{\"b\":[1,{\"c\":null}]}}") == "{\"a\":{\"b\":[1,{\"c\":null}]}}");
+    for (const char *bad : {"", "[", "[1,]", "{\"a\"}", "{\"a\":}", "[1 2]", "tru", "[1]]", "{,}", "1 2", "[}"})
+    {
+        JSON_CHECK(json_test_rejects(bad));
+    }
+    JSON_CHECK(json_test_rejects("[1,x]", 3));
+    JSON_CHECK(JSON_Parser::parse(std::istringstream("[true]"))[0].boolean());
+
+    // Strings longer than one SIMD block of the string scanner, with escapes on either side of block edges
+    std::string text(200, 'x');
+    text[63] = '\\';
+    text[64] = '"';
+    std::string document = "[\"" + text + "\"]";
+    JSON_CHECK(JSON_Parser::parse(document)[0].string() == text.substr(0, 63) + text.substr(64));
+    JSON_CHECK(JSON_Parser::parse(document).to_string() == document);
+
+    // Objects keep their first insertion order and the last duplicate
+    JSON_CHECK(json_test_round_trip("{\"b\":1,\"a\":2,\"b\":3}") == "{\"b\":3,\"a\":2}");
+    std::string wide = "{";
+    for (int i = 0; i < 100; i++)
+    {
+        wide += (i > 0 ? ",\"k" : "\"k") + std::to_string(i) + "\":" + std::to_string(i);
+    }
+    wide += "}";
+    JSON_Value object = JSON_Parser::parse(wide);
+    JSON_CHECK(object["k77"].int64() == 77 && object.to_string() == wide);
+    JSON_CHECK(object.object().erase("k3") == 1 && !object.object().contains("k3") && object["k99"].int64() == 99);
+    const JSON_Value& readonly = object;
+    JSON_CHECK(json_test_throws<std::out_of_range>([&] { readonly["missing"]; }));
+}
+
+static void json_test_numbers()
+{
+    JSON_Value numbers = JSON_Parser::parse("[9007199254740993,-9223372036854775808,18446744073709551615,"
+                                            "18446744073709551616,1.5,-0,1e2,0.1]");
+    JSON_CHECK(numbers[0].is_int64() && numbers[0].int64() == 9007199254740993);
+    JSON_CHECK(numbers[1].int64() == std::numeric_limits<int64_t>::min());
+    JSON_CHECK(numbers[2].is_uint64() && numbers[2].uint64() == std::numeric_limits<uint64_t>::max());
+    JSON_CHECK(!numbers[3].is_uint64() && numbers[3].number() == 18446744073709551616.0);
+    JSON_CHECK(numbers[4].number() == 1.5 && numbers[6].number() == 100 && numbers[7].number() == 0.1);
+    JSON_CHECK(numbers.to_string() == "[9007199254740993,-9223372036854775808,18446744073709551615,"
+                                      "18446744073709551616,1.5,0,100,0.1]");
+    for (const char *bad : {"01", "1.", "-", ".5", "1e", "1e+", "+1", "0x10", "nan", "inf", "[1e400]", "[-1e400]",
+                            "0.1e310", "1000000000000000000000e300"})
+    {
+        JSON_CHECK(json_test_rejects(bad));
+    }
+
+    // Underflow rounds to zero, denormals are kept
+    JSON_Value tiny = JSON_Parser::parse("[1e-400,-1e-400,2e-324,5e-324,1e-310,0.0000000001e-320,100000000000e-320]");
+    JSON_CHECK(tiny[0].number() == 0 && !std::signbit(tiny[0].number()) && std::signbit(tiny[1].number()));
+    JSON_CHECK(tiny[2].number() == 0 && tiny[3].number() == std::numeric_limits<double>::denorm_min());
+    JSON_CHECK(tiny[4].number() == 1e-310 && tiny[5].number() == 0 && tiny[6].number() == 1e-309);
+}
+
+static void json_test_strings()
+{
+    JSON_Value escaped = JSON_Parser::parse("[\"a\\\"b\\\\c\\/d\\n\\u00e9\\ud83d\\ude00\"]");
+    JSON_CHECK(escaped[0].string() == "a\"b\\c/d\n\xc3\xa9\xf0\x9f\x98\x80");
+    JSON_CHECK(escaped.to_string() == "[\"a\\\"b\\\\c/d\\n\xc3\xa9\xf0\x9f\x98\x80\"]");
+    for (const char *bad : {"[\"\\x\"]", "[\"\\u12\"]", "[\"\\ud800\"]", "[\"\\udc00\"]", "{\"\\q\":1}", "[\"abc"})
+    {
+        JSON_CHECK(json_test_rejects(bad));
+    }
+
+    // UTF-8 is validated in short and long strings and in keys
+    JSON_CHECK(JSON_Parser::parse("[\"h\xc3\xa9llo \xe2\x82\xac \xf0\x9f\x98\x80" + std::string(40, 'a') + "\"]")[0].string().size() == 55);
+    JSON_CHECK(json_test_rejects("[\"abc\xff\"]", 5));
+    JSON_CHECK(json_test_rejects("\"\xc0\xaf\"", 1));
+    JSON_CHECK(json_test_rejects("\"\xed\xa0\x80\"", 1));
+    JSON_CHECK(json_test_rejects("\"\xf4\x90\x80\x80\"", 1));
+    JSON_CHECK(json_test_rejects("\"" + std::string(50, 'x') + "\xe2\x82\"", 51));
+    JSON_CHECK(json_test_rejects("{\"k\x80\":1}", 3));
+
+    // Control characters must be escaped, in values and keys of any length
+    JSON_CHECK(json_test_rejects("[\"\x01\"]", 2) && json_test_rejects("[\"a\tb\"]", 3) && json_test_rejects("{\"\n\":1}", 2));
+    JSON_CHECK(json_test_rejects("\"" + std::string(20, 'x') + "\x1f\"", 21));
+    JSON_CHECK(json_test_rejects("\"" + std::string(70, 'x') + "\\n\x7f" + '\0' + "\"", 74));
+    JSON_CHECK(JSON_Parser::parse("\"\x7f\\u0001\"").string() == "\x7f\x01");
+
+    // Writing escapes control characters and replaces invalid UTF-8
+    std::string controls;
+    for (int c = 0; c < 0x20; c++)
+    {
+        controls.push_back(static_cast<char>(c));
+    }
+    std::string mixed = std::string(37, 'a') + controls + "\"\\" + std::string(37, 'b') + "\xe2\x82\xac";
+    JSON_CHECK(JSON_Parser::parse(JSON_Value(mixed).to_string()).string() == mixed);
+    JSON_CHECK(JSON_Value(std::string("a\xff" "b\xe2\x82")).to_string() == "\"a\\ufffdb\\ufffd\\ufffd\"");
+
+    // Borrowed strings point into the input
+    std::string input = "{\"plain\":\"text\",\"esc\":\"a\\tb\"}";
+    JSON_Parse_Options borrow;
+    borrow.borrow_strings = true;
+    JSON_Value borrowed = JSON_Parser::parse(input, borrow);
+    const char *plain = borrowed["plain"].string_view().data();
+    JSON_CHECK(plain > input.data() && plain < input.data() + input.size());
+    JSON_CHECK(borrowed["esc"].string() == "a\tb");
+}
+
+static void json_test_write()
+{
+    JSON_Value value = JSON_Parser::parse("{\"b\":[1,{\"z\":null,\"a\":\"s\"}],\"a\":{},\"c\":[]}");
+    std::string out = "prefix:";
+    value.write(out);
+    JSON_CHECK(out == "prefix:{\"b\":[1,{\"z\":null,\"a\":\"s\"}],\"a\":{},\"c\":[]}");
+    JSON_CHECK(JSON_Value(std::numeric_limits<double>::infinity()).to_string() == "null");
+
+    JSON_Write_Options pretty;
+    pretty.indent = 2;
+    JSON_CHECK(value.to_string(pretty) == "{\n  \"b\": [\n    1,\n    {\n      \"z\": null,\n      \"a\": \"s\"\n    }\n  ],\n"
+                                          "  \"a\": {},\n  \"c\": []\n}");
+    JSON_Write_Options sorted;
+    sorted.sort_keys = true;
+    JSON_CHECK(value.to_string(sorted) == "{\"a\":{},\"b\":[1,{\"a\":\"s\",\"z\":null}],\"c\":[]}");
+
+    JSON_Array items;
+    for (int i = 0; i < 5000; i++)
+    {
+        items.emplace_back(JSON_Object{{"i", JSON_Value(i)}, {"s", JSON_Value("t\n")}});
+    }
+    JSON_Value large(std::move(items));
+    std::string serial = large.to_string();
+    JSON_CHECK(large.to_string_parallel(4) == serial && large.to_string_parallel(1) == serial);
+    std::ostringstream stream;
+    large.write_to(stream);
+    JSON_CHECK(stream.str() == serial);
+    FILE *file = std::tmpfile();
+    large.write_parallel(fileno(file), 3);
+    std::string back(serial.size() + 1, '\0');
+    std::rewind(file);
+    back.resize(std::fread(back.data(), 1, back.size(), file));
+    std::fclose(file);
+    JSON_CHECK(back == serial);
+    JSON_CHECK(json_test_throws<std::system_error>([&] { large.write_to(-1); }));
+}
+
+static void json_test_push()
+{
+    std::string document = "{\"a\\\"b\":[1,-2.5e3,true,null,\"x\\u00e9\\ud83d\\ude00\"],\"long_key_name_xxxxxxxxxxxx\":{\"n\":123456789012}}";
+    std::string expected = json_test_round_trip(document);
+    bool all_splits = true;
+    for (size_t cut = 0; cut <= document.size(); cut++)
+    {
+        JSON_Push_Parser parser;
+        std::string head = document.substr(0, cut);
+        std::string tail = document.substr(cut);
+        parser.feed(head);
+        head.assign(head.size(), '#'); // the parser must not keep pointers into a chunk
+        parser.feed(tail);
+        all_splits &= parser.finish().to_string() == expected;
+    }
+    JSON_CHECK(all_splits);
+    JSON_Push_Parser bytes;
+    for (char c : document)
+    {
+        bytes.feed(&c, 1);
+    }
+    JSON_CHECK(bytes.finish().to_string() == expected);
+    JSON_Push_Parser partial;
+    partial.feed("[1,2");
+    JSON_CHECK(!partial.done());
+    JSON_CHECK(json_test_throws([&] { partial.feed("x]"); }, 3));
+    JSON_Push_Parser truncated;
+    truncated.feed("[\"abc");
+    JSON_CHECK(json_test_throws([&] { truncated.finish(); }));
+}
+
+static void json_test_events()
+{
+    JSON_Test_Events events;
+    JSON_CHECK(JSON_Parser::read("{\"a\":[1,1.5,18446744073709551615,\"x\",true,null],\"b\":{}}", events));
+    JSON_CHECK(events.log == "{k:a;[idus:x;tn]k:b;{}}");
+    JSON_Test_Events stopped;
+    stopped.stop_after = 3;
+    JSON_CHECK(!JSON_Parser::read("[1,2,3,4]", stopped) && stopped.log == "[ii");
+    JSON_Test_Events split;
+    JSON_Reader<JSON_Test_Events> reader(split);
+    JSON_CHECK(reader.feed("[tr") && reader.feed("ue]") && reader.finish() && split.log == "[t]");
+}
+
+static void json_test_lines()
+{
+    // Several pieces of the parallel split, one line longer than a piece
+    std::string lines;
+    const int count = 150000;
+    for (int i = 0; i < count; i++)
+    {
+        lines += "{\"i\":" + std::to_string(i) + "}" + (i % 7 == 0 ? "\r\n\n  \n" : "\n");
+        if (i == 1000)
+        {
+            lines += "\"" + std::string(3 << 20, 'x') + "\"\n";
+        }
+    }
+    auto in_order = [&](const std::vector<JSON_Value>& values) {
+        bool ordered = values.size() == count + 1 && values[1001].string().size() == 3 << 20;
+        for (size_t i = 0, line = 0; ordered && i < values.size(); i++)
+        {
+            ordered = i == 1001 || values[i]["i"].int64() == static_cast<int64_t>(line++);
+        }
+        return ordered;
+    };
+    JSON_CHECK(in_order(JSON_Parser::parse_lines(lines, 4)));
+    JSON_CHECK(in_order(JSON_Parser::parse_lines(lines, 1)));
+    size_t streamed = 0;
+    JSON_Parser::stream_lines(lines, [&](JSON_Value&&) { streamed++; }, 3);
+    JSON_CHECK(streamed == count + 1);
+    JSON_CHECK(JSON_Parser::parse_lines("", 2).empty() && JSON_Parser::parse_lines("1\n[2]", 1).size() == 2);
+
+    // The first error in input order is reported; a throwing callback stops the workers
+    size_t middle = lines.find('\n', lines.size() / 2) + 1;
+    std::string bad = lines;
+    bad.insert(middle, "{\"i\":}\n");
+    bad += "[\n";
+    JSON_CHECK(json_test_throws([&] { JSON_Parser::parse_lines(bad, 3); }, middle + 5));
+    JSON_CHECK(json_test_throws<std::runtime_error>([&] {
+        JSON_Parser::stream_lines(lines, [](JSON_Value&&) { throw std::runtime_error("stop"); }, 4);
+    }));
+}
+
+static void json_test_files()
+{
+    JSON_CHECK(json_test_throws<std::system_error>([] { JSON_Parser::parse_file("/nonexistent/json/file"); }));
+#if defined(JSON_HAS_MMAP)
+    char path[] = "/tmp/json_test_XXXXXX";
+    int fd = ::mkstemp(path);
+    JSON_CHECK(fd >= 0);
+    if (fd < 0)
+    {
+        return;
+    }
+    std::string text = "{\"cfg\":[1,\"two\"]}";
+    JSON_CHECK(::write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size()));
+    ::close(fd);
+    JSON_CHECK(JSON_Parser::parse_file(path).to_string() == text);
+    {
+        JSON_Mapped_File file(path);
+        JSON_Parse_Options borrow;
+        borrow.borrow_strings = true;
+        JSON_Value value = JSON_Parser::parse(file.view(), borrow);
+        JSON_CHECK(value["cfg"][1].string_view().data() == file.view().data() + 11);
+    }
+    ::unlink(path);
+#endif
+}
+
+static void json_test_values()
+{
+    // Arena-backed documents
+    JSON_Document document("{\"key_longer_than_small_strings\":[\"value_longer_than_small_strings\",{\"a\":1}]}");
+    JSON_CHECK(document.root()["key_longer_than_small_strings"][1]["a"].int64() == 1);
+    document.parse("[\"reused\"]");
+    JSON_CHECK(document.root().to_string() == "[\"reused\"]");
+
+    // Moves keep the storage of arrays and strings
+    JSON_Array array;
+    array.emplace_back(1);
+    const JSON_Value *first = array.data();
+    JSON_Value moved(std::move(array));
+    JSON_CHECK(&moved.array()[0] == first);
+    JSON_String str(std::string(100, 'z'));
+    const char *data = str.data();
+    JSON_Value from_string(std::move(str));
+    JSON_CHECK(from_string.string_view().data() == data);
+    std::string standard(100, 'y');
+    data = standard.data();
+    JSON_Value from_standard(std::move(standard));
+    JSON_CHECK(from_standard.string_view().data() == data && from_standard.string() == std::string(100, 'y'));
+    standard.assign(200, 'w');
+    data = standard.data();
+    from_standard = std::move(standard);
+    JSON_CHECK(from_standard.string_view().data() == data && from_standard == JSON_Value(std::string(200, 'w')));
+    JSON_CHECK(JSON_Value::from_cbor(from_standard.to_cbor()) == from_standard);
+    JSON_CHECK(from_standard.to_string() == "\"" + std::string(200, 'w') + "\"");
+    JSON_Value built = JSON_Object();
+    built.emplace("list", JSON_Array{}).emplace_back(true);
+    built["list"].emplace_back(JSON_Object{}).emplace("deep", 2.5);
+    JSON_CHECK(built.to_string() == "{\"list\":[true,{\"deep\":2.5}]}");
+
+    // Compact read-only layout
+    const char *text = "{\"short\":\"abc\",\"long\":\"0123456789abcdef\",\"n\":[1,-2,18446744073709551615,2.5,true,null,[],{}]}";
+    JSON_Compact_Document compact(text);
+    const JSON_Compact_Value& root = compact.root();
+    JSON_CHECK(root.size() == 3 && root["short"].string_view() == "abc" && root["long"].string() == "0123456789abcdef");
+    JSON_CHECK(root["n"][2].uint64() == UINT64_MAX && root["n"][3].number() == 2.5 && root["n"][5].is_null());
+    JSON_CHECK(root.to_value().to_string() == json_test_round_trip(text));
+    JSON_CHECK(json_test_throws<std::out_of_range>([&] { root["n"][99]; }));
+}
+
+static void json_test_documents()
+{
+    const char *text = "{\"s\":\"a\\nb\",\"n\":[1,-2,18446744073709551615,2.5,true,null,[],{}],\"o\":{\"x\":[\"z\"]}}";
+    std::string expected = json_test_round_trip(text);
+
+    JSON_Tape tape(text);
+    JSON_Tape_Ref root = tape.root();
+    JSON_CHECK(root.size() == 3 && root["s"].string() == "a\nb" && root["n"][2].uint64() == UINT64_MAX);
+    JSON_CHECK(root["o"]["x"][0].string() == "z" && root.to_value().to_string() == expected);
+    JSON_CHECK(json_test_throws([] { JSON_Tape bad("[1,"); }));
+
+    JSON_Lazy_Document lazy(text);
+    JSON_Lazy_Value lazy_root = lazy.root();
+    JSON_CHECK(lazy_root["n"].size() == 8 && lazy_root["n"][3].number() == 2.5 && lazy_root["s"].string() == "a\nb");
+    JSON_CHECK(lazy_root["o"].text() == "{\"x\":[\"z\"]}" && lazy_root.to_value().to_string() == expected);
+    JSON_CHECK(json_test_throws<std::out_of_range>([&] { lazy_root["n"][8]; }));
+
+    JSON_Shared_Document shared;
+    JSON_CHECK(!shared.load());
+    shared.publish("{\"version\":1}");
+    auto snapshot = shared.load();
+    shared.publish("{\"version\":2}");
+    JSON_CHECK((*snapshot)["version"].int64() == 1 && (*shared.load())["version"].int64() == 2);
+    JSON_CHECK(json_test_throws([&] { shared.publish("{bad"); }) && (*shared.load())["version"].int64() == 2);
+    JSON_Frozen_Document handed(JSON_Parser::parse("{\"version\":3}"));
+    JSON_CHECK(handed["version"].int64() == 3 && handed.root().to_string() == "{\"version\":3}");
+
+    // Readers never go back to an older version while new ones are published
+    JSON_Shared_Document other(std::make_shared<const JSON_Frozen_Document>("[0]"));
+    std::atomic<bool> stale{false};
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 3; i++)
+    {
+        readers.emplace_back([&] {
+            int64_t last = 0;
+            for (int j = 0; j < 2000; j++)
+            {
+                int64_t seen = (*shared.load())["version"].int64();
+                stale = stale || seen < last || (*other.load())[0].int64() != 0;
+                last = seen;
+            }
+        });
+    }
+    for (int next = 3; next <= 50; next++)
+    {
+        shared.publish("{\"version\":" + std::to_string(next) + "}");
+    }
+    for (std::thread& reader : readers)
+    {
+        reader.join();
+    }
+    JSON_CHECK(!stale && (*shared.load())["version"].int64() == 50 && (*other.load())[0].int64() == 0);
+}
+
+static void json_test_pointer()
+{
+    JSON_Value value = JSON_Parser::parse("{\"user\":{\"id\":42,\"tags\":[\"a\",\"b\"]},\"a/b\":1,\"m~n\":2,\"list\":[{\"id\":1},{\"x\":0},{\"id\":3}]}");
+    JSON_CHECK(JSON_Pointer("/user/id").find(value)->int64() == 42 && JSON_Pointer("").find(value) == &value);
+    JSON_CHECK(JSON_Pointer("/a~1b").find(value)->int64() == 1 && JSON_Pointer("/m~0n").find(value)->int64() == 2);
+    JSON_CHECK(JSON_Pointer("/user/tags/1").find(value)->string() == "b" && !JSON_Pointer("/user/tags/01").find(value));
+    std::string ids;
+    JSON_Pointer("/list/*/id").select(value, [&](const JSON_Value& id) { ids += id.to_string(); });
+    JSON_CHECK(ids == "13");
+    ids.clear();
+    size_t found = JSON_Pointer("/list/*/id").extract(value.to_string(), [&](JSON_Value&& id) { ids += id.to_string(); });
+    JSON_CHECK(found == 2 && ids == "13");
+    JSON_CHECK(json_test_throws([] { JSON_Pointer("a"); }) && json_test_throws([] { JSON_Pointer("/a~2"); }, 2));
+
+    // Interned keys are shared between documents
+    JSON_Key_Table keys;
+    JSON_Parse_Options options;
+    options.keys = &keys;
+    JSON_Value a = JSON_Parser::parse("{\"id\":1,\"name\":\"x\"}", options);
+    JSON_Value b = JSON_Parser::parse("{\"name\":\"y\",\"id\":2}", options);
+    JSON_CHECK(keys.size() == 2 && a.object().begin()->first.str().data() == b.object().find("id")->first.str().data());
+}
+
+static void json_test_binding()
+{
+    std::string text = "{\"extra\":{\"deep\":[1,{\"x\":2}]},\"id\":12,\"name\":\"a\\\"b\",\"path\":[{\"x\":1,\"y\":2.5},{\"y\":-1}],"
+                       "\"nick\":\"n\",\"flags\":[true,false],\"level\":2e0}";
+    JSON_Test_Record record = JSON_Parser::decode<JSON_Test_Record>(text);
+    JSON_CHECK(record.id == 12 && record.name == "a\"b" && record.path.size() == 2 && record.path[1].y == -1);
+    JSON_CHECK(record.nick == "n" && record.flags == std::vector<bool>({true, false}) && record.level == 2);
+    std::string written = json_to_string(record);
+    JSON_CHECK(written == "{\"id\":12,\"name\":\"a\\\"b\",\"path\":[{\"x\":1,\"y\":2.5},{\"x\":0,\"y\":-1}],"
+                         "\"nick\":\"n\",\"flags\":[true,false],\"level\":2}");
+    JSON_CHECK(json_to_string(JSON_Parser::decode<JSON_Test_Record>(written)) == written);
+    JSON_CHECK(!JSON_Parser::decode<JSON_Test_Record>("{\"nick\":null}").nick);
+    for (const char *bad : {"{\"level\":300}", "{\"id\":\"x\"}", "{\"id\":1.5}", "{\"path\":{}}", "{\"flags\":[1]}", "{\"id\":1"})
+    {
+        JSON_CHECK(json_test_throws([&] { JSON_Parser::decode<JSON_Test_Record>(bad); }));
+    }
+}
+
+static void json_test_cbor()
+{
+    JSON_Value value = JSON_Parser::parse("{\"a\":[0,23,24,255,256,65536,4294967296,-1,-25,-9223372036854775808,"
+                                          "18446744073709551615,1.5,0.1,true,false,null,\"\",\"h\\u00e9\"],\"b\":{}}");
+    JSON_CHECK(JSON_Value::from_cbor(value.to_cbor()) == value);
+    JSON_CHECK(JSON_Value(int64_t(500)).to_cbor() == std::string("\x19\x01\xf4") && JSON_Value(1.5).to_cbor().size() == 5);
+    // RFC 8949 appendix A: half floats, indefinite lengths, tags
+    JSON_CHECK(JSON_Value::from_cbor(std::string("\xf9\xc4\x00", 3)).number() == -4.0);
+    JSON_CHECK(JSON_Value::from_cbor("\x9f\x01\x82\x02\x03\x9f\x04\x05\xff\xff").to_string() == "[1,[2,3],[4,5]]");
+    JSON_CHECK(JSON_Value::from_cbor("\x7f\x65strea\x64ming\xff").string() == "streaming");
+    JSON_CHECK(JSON_Value::from_cbor("\xc1\x1a\x51\x4b\x67\xb0").int64() == 1363896240);
+    for (std::string bad : {std::string("\x9b\xff\xff\xff\xff\xff\xff\xff\xff"), std::string("\x43\x01"), std::string("\x01\x00", 2),
+                            std::string("\xa1\x01\x02"), std::string(""), std::string("\x1c"), std::string(2000000, '\x7f')})
+    {
+        JSON_CHECK(json_test_throws([&] { JSON_Value::from_cbor(bad); }));
+    }
+    JSON_Parse_Options shallow;
+    shallow.max_depth = 2;
+    shallow.max_size = 4;
+    JSON_CHECK(JSON_Value::from_cbor("\x81\x81\x01", shallow).to_string() == "[[1]]");
+    JSON_CHECK(json_test_throws([&] { JSON_Value::from_cbor("\x81\x81\x81\x01", shallow); }, 3));
+    JSON_CHECK(json_test_throws([&] { JSON_Value::from_cbor("\x85\x01\x02\x03\x04\x05", shallow); }, 4));
+}
+
+static void json_test_patch()
+{
+    auto round_trip = [](const char *from, const char *to) {
+        JSON_Value value = JSON_Parser::parse(from);
+        value.apply_patch(JSON_Value::diff(value, JSON_Parser::parse(to)));
+        return value == JSON_Parser::parse(to);
+    };
+    JSON_CHECK(round_trip("{\"a\":1,\"b\":[1,2,3]}", "{\"b\":[1,9,2,3],\"e\":null}"));
+    JSON_CHECK(round_trip("[1,2,3,4,5]", "[1,5]") && round_trip("{\"a/b\":{\"~\":1}}", "{\"a/b\":{\"~\":2}}"));
+    JSON_CHECK(JSON_Parser::parse("1") == JSON_Parser::parse("1.0") && !(JSON_Parser::parse("[1,2]") == JSON_Parser::parse("[2,1]")));
+
+    JSON_Value document = JSON_Parser::parse("{\"foo\":[\"bar\",\"baz\"]}");
+    document.apply_patch(JSON_Parser::parse("[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"},"
+                                            "{\"op\":\"test\",\"path\":\"/foo/2\",\"value\":\"baz\"},"
+                                            "{\"op\":\"move\",\"from\":\"/foo/0\",\"path\":\"/first\"},"
+                                            "{\"op\":\"copy\",\"from\":\"/first\",\"path\":\"/foo/-\"},"
+                                            "{\"op\":\"replace\",\"path\":\"/foo/0\",\"value\":1},"
+                                            "{\"op\":\"remove\",\"path\":\"/foo/1\"}]"));
+    JSON_CHECK(document.to_string() == "{\"foo\":[1,\"bar\"],\"first\":\"bar\"}");
+    auto failing = [](const char *target, const char *patch) -> size_t {
+        JSON_Value value = JSON_Parser::parse(target);
+        try
+        {
+            value.apply_patch(JSON_Parser::parse(patch));
+        }
+        catch (const JSON_Patch_Error& error)
+        {
+            return error.operation;
+        }
+        return SIZE_MAX;
+    };
+    JSON_CHECK(failing("{\"a\":1}", "[{\"op\":\"test\",\"path\":\"/a\",\"value\":1},{\"op\":\"test\",\"path\":\"/a\",\"value\":2}]") == 1);
+    JSON_CHECK(failing("{\"a\":1}", "[{\"op\":\"remove\",\"path\":\"/b\"}]") == 0);
+    JSON_CHECK(failing("{\"a\":{\"b\":1}}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a/b/c\"}]") == 0);
+
+    // A failing move keeps its source in place
+    auto unmoved = [](const char *target, const char *from, const char *path) {
+        JSON_Value value = JSON_Parser::parse(target);
+        std::string patch = "[{\"op\":\"move\",\"from\":\"" + std::string(from) + "\",\"path\":\"" + path + "\"}]";
+        return json_test_throws<JSON_Patch_Error>([&] { value.apply_patch(JSON_Parser::parse(patch)); }) &&
+               value.to_string() == target;
+    };
+    JSON_CHECK(unmoved("{\"a\":1,\"b\":2}", "/a", "/x/y"));
+    JSON_CHECK(unmoved("[1,2,3]", "/0", "/3") && unmoved("[[1],2]", "/1", "/0/5") && unmoved("[1,[2]]", "/0", "/1/0/x"));
+    JSON_Value shifted = JSON_Parser::parse("[1,2,[3]]");
+    shifted.apply_patch(JSON_Parser::parse("[{\"op\":\"move\",\"from\":\"/0\",\"path\":\"/1/1\"}]"));
+    JSON_CHECK(shifted.to_string() == "[2,[3,1]]");
+
+    JSON_Value merged = JSON_Parser::parse("{\"title\":\"a\",\"author\":{\"given\":\"J\",\"family\":\"D\"},\"tags\":[1]}");
+    merged.merge_patch(JSON_Parser::parse("{\"title\":\"b\",\"author\":{\"family\":null},\"tags\":[],\"new\":true}"));
+    JSON_CHECK(merged.to_string() == "{\"title\":\"b\",\"author\":{\"given\":\"J\"},\"tags\":[],\"new\":true}");
+}
+
+static void json_test_schema()
+{
+    JSON_Schema schema(JSON_Parser::parse("{\"type\":\"object\",\"required\":[\"id\"],\"additionalProperties\":false,"
+                                          "\"properties\":{\"id\":{\"type\":\"integer\",\"minimum\":1},"
+                                          "\"tags\":{\"type\":\"array\",\"items\":{\"type\":\"string\"},\"maxItems\":2}}}"));
+    schema.validate("{\"id\":2.0,\"tags\":[\"a\",\"b\"]}");
+    JSON_CHECK(schema.parse("{\"id\":7,\"tags\":[\"x\"]}").to_string() == "{\"id\":7,\"tags\":[\"x\"]}");
+    for (const char *bad : {"{\"id\":0}", "{\"id\":1.5}", "{}", "{\"id\":1,\"x\":1}", "{\"id\":1,\"tags\":[1]}",
+                            "{\"id\":1,\"tags\":[\"a\",\"b\",\"c\"]}", "[]"})
+    {
+        JSON_CHECK(json_test_throws([&] { schema.validate(bad); }));
+    }
+    JSON_CHECK(json_test_throws<std::invalid_argument>([] { JSON_Schema unsupported(JSON_Parser::parse("{\"anyOf\":[]}")); }));
+}
+
+static void json_test_limits()
+{
+    auto nested = [](size_t depth) { return std::string(depth, '[') + std::string(depth, ']'); };
+    JSON_CHECK(json_test_rejects(nested(1025), 1024) && JSON_Parser::parse(nested(1024)).type() == JSON_Type::ARRAY);
+    JSON_Parse_Options small;
+    small.max_size = 8;
+    JSON_CHECK(json_test_throws([&] { JSON_Parser::parse("[1,2,3,4]", small); }, 8));
+
+    // Deep trees are written and destroyed without recursion
+    JSON_Parse_Options deep;
+    deep.max_depth = 100000;
+    std::string text = nested(100000);
+    JSON_Value tree = JSON_Parser::parse(text, deep);
+    JSON_CHECK(tree.to_string() == text && tree.to_cbor().size() == 100000);
+    JSON_CHECK(json_test_throws([] { JSON_Value::from_cbor(std::string(2000, '\x81') + '\x01'); }));
+}
+
+static void json_test_stats()
+{
+#if defined(JSON_STATS)
+    JSON_Parse_Stats stats;
+    JSON_Parse_Options options;
+    options.stats = &stats;
+    std::string text = "{\"a\":[1,2.5,\"x\",true,null,{\"b\":[]}]}";
+    JSON_Parser::parse(text, options);
+    JSON_CHECK(stats.bytes == text.size() && stats.keys == 2 && stats.max_depth == 4);
+    JSON_CHECK(stats.values[static_cast<int>(JSON_Type::NUMBER)] == 2 && stats.values[static_cast<int>(JSON_Type::ARRAY)] == 2);
+#endif
+}
+
+static void json_test_reusable()
+{
+    JSON_Reusable_Parser parser;
+    JSON_Value kept = parser.parse("{\"a\":[1,2]}");
+    JSON_CHECK(parser.parse("[true]").to_string() == "[true]" && kept.to_string() == "{\"a\":[1,2]}");
+    JSON_CHECK(json_test_throws([&] { parser.parse("{\"a\" 1}"); }, 5) && parser.parse(" 7 ").int64() == 7);
+    size_t capacity = 0;
+    for (int i = 0; i < 20; i++)
+    {
+        const JSON_Value& tree = parser.parse_in_arena("{\"id\":" + std::to_string(i) + ",\"tags\":[\"x\",\"y\"]}");
+        JSON_CHECK(tree["id"].int64() == i && tree["tags"][1].string() == "y");
+        capacity = i == 2 ? parser.arena_capacity() : capacity;
+    }
+    JSON_CHECK(capacity > 0 && parser.arena_capacity() == capacity);
+}
+
+static void json_test_columns()
+{
+    JSON_Columns table = JSON_Columns::parse("[{\"ts\":1,\"v\":2,\"tag\":\"a\"},{\"v\":2.5,\"ts\":2,\"ok\":true},{\"ts\":3,\"tag\":null,\"v\":-1}]");
+    JSON_CHECK(table.rows == 3 && table.columns.size() == 4);
+    JSON_CHECK(table["ts"].int64s == std::vector<int64_t>({1, 2, 3}) && table["v"].doubles == std::vector<double>({2, 2.5, -1}));
+    JSON_CHECK(table["tag"].string(0) == "a" && table["tag"].present == std::vector<uint8_t>({1, 0, 0}));
+    JSON_CHECK(table["ok"].kind == JSON_Columns::Kind::BOOLEAN && table.find("missing") == nullptr);
+    JSON_Columns shaped = JSON_Columns::parse("[{\"ts\":1,\"x\":{\"y\":[1]}},{\"ts\":5}]", {{"ts", JSON_Columns::Kind::INT64}});
+    JSON_CHECK(shaped.columns.size() == 1 && shaped["ts"].int64s == std::vector<int64_t>({1, 5}));
+    for (const char *bad : {"{\"a\":1}", "[1]", "[{\"a\":[1]}]", "[{\"a\":1},{\"a\":\"x\"}]"})
+    {
+        JSON_CHECK(json_test_throws([&] { JSON_Columns::parse(bad); }));
+    }
+}
+
+int main()
+{
+    json_test_parse();
+    json_test_numbers();
+    json_test_strings();
+    json_test_write();
+    json_test_push();
+    json_test_events();
+    json_test_lines();
+    json_test_files();
+    json_test_values();
+    json_test_documents();
+    json_test_pointer();
+    json_test_binding();
+    json_test_cbor();
+    json_test_patch();
+    json_test_schema();
+    json_test_limits();
+    json_test_stats();
+    json_test_reusable();
+    json_test_columns();
+    std::cout << (json_test_failures == 0 ? "all checks passed" : "checks failed") << std::endl;
+    return json_test_failures == 0 ? 0 : 1;
+}
+#else
 int main()
 {
     JSON_Object data;
@@ -428,3 +8489,4 @@ int main()
 
     return 0;
 }
+#endif